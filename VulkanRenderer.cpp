@@ -1,9 +1,15 @@
 #include "VulkanRenderer.h"
 #include "utils.h"
+#include "meshoptimize.h"
+#include "meshcache.h"
+#include "texturecooker.h"
 
 #include <map>
+#include <algorithm>
 #include <set>
 #include <array>
+#include <memory>
+#include <chrono>
 #include <gtc/matrix_transform.hpp>
 
 #include <assimp/Importer.hpp>
@@ -12,35 +18,18 @@
 
 void VulkanRenderer::cleanupAfterResize()
 {
+   //the recording slots depend on the image count of the swapchain
+   destroyCommandBuffers();
+
    if (!subPassBInputDescriptorSets.empty())
       vkFreeDescriptorSets(mainDevice.logicalDevice, subPassBInputsDescriptorPool, static_cast<uint32_t>(subPassBInputDescriptorSets.size()), subPassBInputDescriptorSets.data());
    subPassBInputDescriptorSets.clear();
 
    for (auto& depthBuffer : depthBuffers)
-      depthBuffer.clean(mainDevice.logicalDevice);
+      depthBuffer.clean(mainDevice.logicalDevice, memoryAllocator);
 
    for (auto& colorBuffer : colorBuffers)
-      colorBuffer.clean(mainDevice.logicalDevice);
-
-   if (subPassAGraphicsPipeline != VK_NULL_HANDLE)
-      vkDestroyPipeline(mainDevice.logicalDevice, subPassAGraphicsPipeline, nullptr);
-
-   subPassAGraphicsPipeline = VK_NULL_HANDLE;
-
-   if (subPassAPipelineLayout != VK_NULL_HANDLE)
-      vkDestroyPipelineLayout(mainDevice.logicalDevice, subPassAPipelineLayout, nullptr);
-
-   subPassAPipelineLayout = VK_NULL_HANDLE;
-
-   if (subPassBGraphicsPipeline != VK_NULL_HANDLE)
-      vkDestroyPipeline(mainDevice.logicalDevice, subPassBGraphicsPipeline, nullptr);
-
-   subPassBGraphicsPipeline = VK_NULL_HANDLE;
-
-   if (subPassBPipelineLayout != VK_NULL_HANDLE)
-      vkDestroyPipelineLayout(mainDevice.logicalDevice, subPassBPipelineLayout, nullptr);
-
-   subPassBPipelineLayout = VK_NULL_HANDLE;
+      colorBuffer.clean(mainDevice.logicalDevice, memoryAllocator);
 
    for (auto& framebuffer : swapChainFramebuffers)
       vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
@@ -65,10 +54,10 @@ void VulkanRenderer::initAfterResize()
 {
    swapchainDetails = getSwapchainDetails(mainDevice.physicalDevice, surface);
    createSwapChain();
-   createGraphicsPipeline();
    createDepthBuffer();
    createColorBuffer();
    createFrameBuffers();
+   allocateCommandBuffers();
    createSubPassBInputDescriptorSet();
 
    uboViewProjection.projection = glm::perspective(glm::radians(45.0f), static_cast<float>(currentResolution.width) / currentResolution.height, 0.1f, 100.0f);
@@ -81,14 +70,21 @@ void VulkanRenderer::resized()
    vkDeviceWaitIdle(mainDevice.logicalDevice);
    cleanupAfterResize();
    initAfterResize();
+
+   //the pipelines stay, but the recordings hold the old framebuffers and viewport
+   invalidateRecordings();
 }
 
-int VulkanRenderer::init(GLFWwindow* window, bool useFixedCommandBufferRecordings)
+int VulkanRenderer::init(GLFWwindow* window, bool useFixedCommandBufferRecordings, VertexFormat vertexFormat, bool useBindlessTextures)
 {
    this->window = window;
    this->useFixedCommandBufferRecordings = useFixedCommandBufferRecordings;
+   this->vertexFormat = vertexFormat;
+   this->useBindlessTextures = useBindlessTextures; //cleared by createLogicalDevice when the device can not do it
    try
    {
+      threadPool.init();
+
       //setup
       createInstance();
       hookDebugMessager();
@@ -97,8 +93,14 @@ int VulkanRenderer::init(GLFWwindow* window, bool useFixedCommandBufferRecording
       queueFamilyIndices = getQueueFamilyIndices(mainDevice.physicalDevice);
       swapchainDetails = getSwapchainDetails(mainDevice.physicalDevice, surface);
       createLogicalDevice();// and logical queues
+      memoryAllocator.init(mainDevice.physicalDevice, mainDevice.logicalDevice);
+      pipelineCache.init(mainDevice.physicalDevice, mainDevice.logicalDevice);
+      shaderLibrary.init(mainDevice.logicalDevice);
+      frameTimeline.init(mainDevice.logicalDevice);
+      uploadTimeline.init(mainDevice.logicalDevice);
+      copyTimeline.init(mainDevice.logicalDevice);
+      geometryPool.init(&memoryAllocator, mainDevice.logicalDevice, vertexFormat == VertexFormat::packed ? sizeof(PackedVertex) : sizeof(Vertex));
       createSwapChain(); // and swapchain images
-      allocateDynamicBufferTransferSpace();
       depthBufferFormat = choseOptimalImageFormat(
          { VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
          VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
@@ -124,7 +126,7 @@ int VulkanRenderer::init(GLFWwindow* window, bool useFixedCommandBufferRecording
 
       uboViewProjection.projection[1][1] *= -1.0;
 
-      loadTexture("uv-test.png");//default texture
+      defaultTextureHandle = loadTexture("uv-test.png");
 
       //render something
       allocateCommandBuffers();
@@ -153,39 +155,28 @@ void VulkanRenderer::cleanup()
 {
    vkDeviceWaitIdle(mainDevice.logicalDevice);
 
+   pendingUploads.clear();
+   deletionQueue.flush();
+
    for (auto& i : loadedTextures)
-   {
-      vkFreeMemory(mainDevice.logicalDevice, i.memory, nullptr);
-      vkDestroyImageView(mainDevice.logicalDevice, i.imageView, nullptr);
-      vkDestroyImage(mainDevice.logicalDevice, i.image, nullptr);
-      vkFreeDescriptorSets(mainDevice.logicalDevice, subPassASamplerDescriptorPool, 1, &i.samplerSet);
-   }
+      destroyTexture(i);
    loadedTextures.clear();
+   textureRegistry.clear();
+   defaultTextureHandle = TextureRegistry::INVALID_HANDLE;
 
    if (textureSampler != VK_NULL_HANDLE)
       vkDestroySampler(mainDevice.logicalDevice, textureSampler, nullptr);
    textureSampler = VK_NULL_HANDLE;
 
-   if(modelTransferSpace)
-      _aligned_free(modelTransferSpace);
-   modelTransferSpace = nullptr;
-
    for(auto& m : meshes)
       m.clean();
 
-   for (auto& i : uboBuffersMemory)
-   {
-      if (i != VK_NULL_HANDLE)
-         vkFreeMemory(mainDevice.logicalDevice, i, nullptr);
-   }
-   uboBuffersMemory.clear();
+   geometryPool.cleanup();
 
-   for (auto& i : dynamicUboBuffersMemory)
-   {
-      if (i != VK_NULL_HANDLE)
-         vkFreeMemory(mainDevice.logicalDevice, i, nullptr);
-   }
-   dynamicUboBuffersMemory.clear();
+   threadPool.cleanup();
+
+   uniformRing.cleanup();
+   objectRing.reset();
 
    if (!subPassBInputDescriptorSets.empty())
       vkFreeDescriptorSets(mainDevice.logicalDevice, subPassBInputsDescriptorPool, static_cast<uint32_t>(subPassBInputDescriptorSets.size()), subPassBInputDescriptorSets.data());
@@ -195,64 +186,42 @@ void VulkanRenderer::cleanup()
       vkDestroyDescriptorPool(mainDevice.logicalDevice, subPassBInputsDescriptorPool, nullptr);
    subPassBInputsDescriptorPool = VK_NULL_HANDLE;
 
-   if (!subPassABufferDescriptorSets.empty())
-      vkFreeDescriptorSets(mainDevice.logicalDevice, subPassABufferDescriptorPool, static_cast<uint32_t>(subPassABufferDescriptorSets.size()), subPassABufferDescriptorSets.data());
-   subPassABufferDescriptorSets.clear();
+   if (subPassABufferDescriptorSet != VK_NULL_HANDLE)
+      vkFreeDescriptorSets(mainDevice.logicalDevice, subPassABufferDescriptorPool, 1, &subPassABufferDescriptorSet);
+   subPassABufferDescriptorSet = VK_NULL_HANDLE;
 
    if (subPassABufferDescriptorPool != VK_NULL_HANDLE)
       vkDestroyDescriptorPool(mainDevice.logicalDevice, subPassABufferDescriptorPool, nullptr);
    subPassABufferDescriptorPool = VK_NULL_HANDLE;
 
    //the descriptor sets are with the images
-   if (subPassASamplerDescriptorPool != VK_NULL_HANDLE)
-      vkDestroyDescriptorPool(mainDevice.logicalDevice, subPassASamplerDescriptorPool, nullptr);
-   subPassASamplerDescriptorPool = VK_NULL_HANDLE;
+   for (auto pool : samplerDescriptorPools)
+      vkDestroyDescriptorPool(mainDevice.logicalDevice, pool, nullptr);
+   samplerDescriptorPools.clear();
 
-   for (auto& i : uboBuffers)
-   {
-      if (i != VK_NULL_HANDLE)
-         vkDestroyBuffer(mainDevice.logicalDevice, i, nullptr);
-   }
-   uboBuffers.clear();
+   destroySyncronization();
+   destroyCommandBuffers();
 
-   for (auto& i : dynamicUboBuffers)
-   {
-      if (i != VK_NULL_HANDLE)
-         vkDestroyBuffer(mainDevice.logicalDevice, i, nullptr);
-   }
-   dynamicUboBuffers.clear();
+   frameTimeline.cleanup();
+   uploadTimeline.cleanup();
+   copyTimeline.cleanup();
 
-   for (size_t i = 0; i < drawFences.size(); ++i)
-   {
-      if (drawFences[i] != VK_NULL_HANDLE)
-         vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
-   }
-   drawFences.clear();
+   if (uploadCommandPool != VK_NULL_HANDLE)
+      vkDestroyCommandPool(mainDevice.logicalDevice, uploadCommandPool, nullptr);
 
-   for (size_t i = 0; i < imagesAvailable.size(); ++i)
-   {
-      if (imagesAvailable[i] != VK_NULL_HANDLE)
-         vkDestroySemaphore(mainDevice.logicalDevice, imagesAvailable[i], nullptr);
-   }
-   imagesAvailable.clear();
+   uploadCommandPool = VK_NULL_HANDLE;
 
-   for (size_t i = 0; i < rendersFinished.size(); ++i)
-   {
-      if (rendersFinished[i] != VK_NULL_HANDLE)
-         vkDestroySemaphore(mainDevice.logicalDevice, rendersFinished[i], nullptr);
-   }
-   rendersFinished.clear();
+   if (transferCommandPool != VK_NULL_HANDLE)
+      vkDestroyCommandPool(mainDevice.logicalDevice, transferCommandPool, nullptr);
 
-   if (graphicsCommandPool != VK_NULL_HANDLE)
-      vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
-
-   graphicsCommandPool = VK_NULL_HANDLE;
+   transferCommandPool = VK_NULL_HANDLE;
+   uploadQueues = UploadQueues();
 
    for (auto& depthBuffer : depthBuffers)
-      depthBuffer.clean(mainDevice.logicalDevice);
+      depthBuffer.clean(mainDevice.logicalDevice, memoryAllocator);
 
    for (auto& colorBuffer : colorBuffers)
-      colorBuffer.clean(mainDevice.logicalDevice);
+      colorBuffer.clean(mainDevice.logicalDevice, memoryAllocator);
 
    for (auto& framebuffer : swapChainFramebuffers)
    {
@@ -312,6 +281,10 @@ void VulkanRenderer::cleanup()
 
    swapChain = VK_NULL_HANDLE;
 
+   memoryAllocator.cleanup();
+   pipelineCache.cleanup();
+   shaderLibrary.cleanup();
+
    if (VK_NULL_HANDLE != mainDevice.logicalDevice)
       vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 
@@ -345,54 +318,79 @@ void VulkanRenderer::draw()
 
    //TODO recreate swapchain and framebuffers if needed here if the results are invalid
 
-   if (VK_SUCCESS != vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame % MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT], VK_TRUE, UINT64_MAX))
-      throw std::runtime_error("Unable to get unused image");
+   //everything the frame slot owns is free after its last frame, the ring partitions, attachments and recordings of the slot
+   size_t frame = currentFrame % framesInFlight;
+   frameTimeline.wait(frameValues[frame]);
 
-   if (VK_SUCCESS != vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame % MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT]))
-      throw std::runtime_error("Unable to reset fence for used image");
+   retireUploads();
+   deletionQueue.collect(frameTimeline.getCompleted());
 
    uint32_t imageIndex = 0;
    VkResult aquieredImage = vkAcquireNextImageKHR(
       mainDevice.logicalDevice, 
       swapChain, UINT64_MAX, 
-      imagesAvailable[currentFrame % MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT], 
+      imagesAvailable[frame], 
       VK_NULL_HANDLE, 
       &imageIndex);
 
+   //a skipped frame signals nothing, the slot keeps the value of the last frame submitted from it
    if (aquieredImage == VK_ERROR_OUT_OF_DATE_KHR)
    {
       resized();
       return;
    }
 
-   updateUniformBuffers(imageIndex);
-   if (!useFixedCommandBufferRecordings)
-      recordCommandBuffers(imageIndex);
+   //images can be acquired out of order, another frame slot can still be drawing into this one
+   frameTimeline.wait(imageFrameValues[imageIndex]);
+
+   updateUniformBuffers(frame);
+
+   //steady frames record nothing, only a command buffer older than the last change is recorded again
+   size_t slot = getRecordingSlot(frame, imageIndex);
+   if (recordedVersions[slot] != recordingsVersion)
+      recordCommandBuffers(frame, imageIndex);
 
    if (VK_SUCCESS != aquieredImage)
       throw std::runtime_error("Unable to get next swapchain image");
 
+   //the slots only take the value once it was submitted, a failed submission must not be waited for
+   uint64_t frameValue = frameTimeline.getNext();
+
+   //acquire and present only take binary semaphores, the timeline one is signaled next to the one present waits for
+   VkSemaphore signalSemaphores[] = { rendersFinished[frame], frameTimeline.get() };
+   uint64_t signalValues[] = { 0, frameValue };
+
+   VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+   timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+   timelineInfo.signalSemaphoreValueCount = 2;
+   timelineInfo.pSignalSemaphoreValues = signalValues;
+
    VkSubmitInfo submitInfo = {};
    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+   submitInfo.pNext = &timelineInfo;
    
    VkPipelineStageFlags waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-   submitInfo.pWaitSemaphores = &imagesAvailable[currentFrame % MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT];
+   submitInfo.pWaitSemaphores = &imagesAvailable[frame];
    submitInfo.pWaitDstStageMask = &waitStages; //wait unit signaled
    submitInfo.waitSemaphoreCount = 1;
    
-   submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+   submitInfo.pCommandBuffers = &commandBuffers[slot];
    submitInfo.commandBufferCount = 1;
 
-   submitInfo.pSignalSemaphores = &rendersFinished[currentFrame % MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT]; // signaled when presented
-   submitInfo.signalSemaphoreCount = 1;
+   submitInfo.pSignalSemaphores = signalSemaphores; // signaled when presented
+   submitInfo.signalSemaphoreCount = 2;
 
-   VkResult queueSubmited = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences[currentFrame % MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT]);
+   VkResult queueSubmited = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
    if (VK_SUCCESS != queueSubmited)
       throw std::runtime_error("Unable to submit");
 
+   frameTimeline.next();
+   frameValues[frame] = frameValue;
+   imageFrameValues[imageIndex] = frameValue;
+
    VkPresentInfoKHR presentInfo = {};
    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-   presentInfo.pWaitSemaphores = &rendersFinished[currentFrame % MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT];
+   presentInfo.pWaitSemaphores = &rendersFinished[frame];
    presentInfo.waitSemaphoreCount = 1;
    presentInfo.pSwapchains = &swapChain;
    presentInfo.swapchainCount = 1;
@@ -495,6 +493,7 @@ void VulkanRenderer::createLogicalDevice()
    std::set<int32_t> usedQueues;
    usedQueues.insert(queueFamilyIndices.graphicFamily);
    usedQueues.insert(queueFamilyIndices.presentationFamily);
+   usedQueues.insert(queueFamilyIndices.transferFamily);
    std::vector<VkDeviceQueueCreateInfo> queueCreateionInfos;
    for (auto& i : usedQueues)
    {
@@ -514,13 +513,73 @@ void VulkanRenderer::createLogicalDevice()
    createInfo.pQueueCreateInfos = queueCreateionInfos.data();
    createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateionInfos.size());
 
-   createInfo.enabledExtensionCount = 1;
-   const char* extensionNames = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
-   createInfo.ppEnabledExtensionNames = &extensionNames;
+   std::vector<const char*> extensionNames = { VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+
+   VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexingFeatures = {};
+   supportedIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+   VkPhysicalDeviceTimelineSemaphoreFeaturesKHR supportedTimelineFeatures = {};
+   supportedTimelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+   VkPhysicalDeviceFeatures2 supportedFeatures = {};
+   supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+   supportedFeatures.pNext = &supportedTimelineFeatures;
+   bool hasDescriptorIndexing = checkDeviceExtensionSupport(mainDevice.physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+   if (hasDescriptorIndexing)
+      supportedTimelineFeatures.pNext = &supportedIndexingFeatures;
+   vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &supportedFeatures);
+
+   if (!supportedTimelineFeatures.timelineSemaphore)
+      throw std::runtime_error("Timeline semaphores are not supported by the device");
+
+   //block compressed textures are used when the device has them, loadTexture falls back to rgba8 otherwise
+   mainDevice.textureCompressionBC = supportedFeatures.features.textureCompressionBC == VK_TRUE;
 
-   VkPhysicalDeviceFeatures deviceFeatures = {};
-   createInfo.pEnabledFeatures = &deviceFeatures;
-   //TODO : Add device features
+   VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+   timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+   timelineFeatures.timelineSemaphore = VK_TRUE;
+
+   VkPhysicalDeviceFeatures2 deviceFeatures = {};
+   deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+   deviceFeatures.pNext = &timelineFeatures;
+   deviceFeatures.features.textureCompressionBC = supportedFeatures.features.textureCompressionBC;
+
+   //the bindless array is runtime sized, indexed with the push constant, partially bound and gets new textures while the frames that use the others are pending
+   useBindlessTextures = useBindlessTextures && hasDescriptorIndexing && supportedFeatures.features.shaderSampledImageArrayDynamicIndexing &&
+      supportedIndexingFeatures.runtimeDescriptorArray && supportedIndexingFeatures.descriptorBindingPartiallyBound &&
+      supportedIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind && supportedIndexingFeatures.descriptorBindingUpdateUnusedWhilePending;
+
+   VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+   indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+   if (useBindlessTextures)
+   {
+      extensionNames.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+      deviceFeatures.features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+      indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+      indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+      indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+      indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+      timelineFeatures.pNext = &indexingFeatures;
+
+      //a combined image sampler counts as both a sampler and a sampled image
+      VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {};
+      indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+      VkPhysicalDeviceProperties2 properties = {};
+      properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+      properties.pNext = &indexingProperties;
+      vkGetPhysicalDeviceProperties2(mainDevice.physicalDevice, &properties);
+
+      bindlessTextureCapacity = std::min({ MAX_BINDLESS_TEXTURES,
+         indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers, indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+         indexingProperties.maxDescriptorSetUpdateAfterBindSamplers, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages });
+   }
+
+   createInfo.enabledExtensionCount = static_cast<uint32_t>(extensionNames.size());
+   createInfo.ppEnabledExtensionNames = extensionNames.data();
+
+   //the features go in the chain, pEnabledFeatures must stay empty
+   createInfo.pNext = &deviceFeatures;
+   createInfo.pEnabledFeatures = nullptr;
 
    VkDevice device = VK_NULL_HANDLE;
    if (VK_SUCCESS != vkCreateDevice(mainDevice.physicalDevice, &createInfo, nullptr, &device))
@@ -530,6 +589,7 @@ void VulkanRenderer::createLogicalDevice()
 
    vkGetDeviceQueue(mainDevice.logicalDevice, queueFamilyIndices.graphicFamily, 0, &graphicsQueue);
    vkGetDeviceQueue(mainDevice.logicalDevice, queueFamilyIndices.presentationFamily, 0, &presentationQueue);
+   vkGetDeviceQueue(mainDevice.logicalDevice, queueFamilyIndices.transferFamily, 0, &transferQueue);
 }
 
 QueueFamilyIndices VulkanRenderer::getQueueFamilyIndices(VkPhysicalDevice device) const
@@ -544,30 +604,49 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilyIndices(VkPhysicalDevice device
 
    QueueFamilyIndices out;
    int32_t index = 0;
+   int32_t transferOnlyFamily = -1;
+   int32_t transferWithComputeFamily = -1;
    for (auto& property : properties)
    {
-      if (property.queueFlags & VK_QUEUE_GRAPHICS_BIT && property.queueCount > 0)
+      if (property.queueFlags & VK_QUEUE_GRAPHICS_BIT && property.queueCount > 0 && out.graphicFamily < 0)
       {
          out.graphicFamily = index;
       }
       VkBool32 supportPresentation = false;
-      if (VK_SUCCESS == vkGetPhysicalDeviceSurfaceSupportKHR(device, index, surface, &supportPresentation) && supportPresentation && property.queueCount > 0)
+      if (VK_SUCCESS == vkGetPhysicalDeviceSurfaceSupportKHR(device, index, surface, &supportPresentation) && supportPresentation && property.queueCount > 0 && out.presentationFamily < 0)
       {
          out.presentationFamily = index;
       }
 
-      ++index;
-
-      if (out.valid())
+      //the dma engines are exposed as families without graphics, the ones without compute are the best match
+      if (property.queueFlags & VK_QUEUE_TRANSFER_BIT && !(property.queueFlags & VK_QUEUE_GRAPHICS_BIT) && property.queueCount > 0)
       {
-         break;
+         if (!(property.queueFlags & VK_QUEUE_COMPUTE_BIT) && transferOnlyFamily < 0)
+            transferOnlyFamily = index;
+         else if (transferWithComputeFamily < 0)
+            transferWithComputeFamily = index;
       }
+
+      ++index;
    }
 
+   //graphics queues always support transfers
+   if (transferOnlyFamily >= 0)
+      out.transferFamily = transferOnlyFamily;
+   else if (transferWithComputeFamily >= 0)
+      out.transferFamily = transferWithComputeFamily;
+   else
+      out.transferFamily = out.graphicFamily;
+
    return out;
 }
 
 bool VulkanRenderer::checkDeviceSwapChainSupport(VkPhysicalDevice device) const
+{
+   return checkDeviceExtensionSupport(device, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+}
+
+bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice device, const char* extensionName) const
 {
    uint32_t extensionCount = 0;
    if (VK_SUCCESS != vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr))
@@ -579,7 +658,7 @@ bool VulkanRenderer::checkDeviceSwapChainSupport(VkPhysicalDevice device) const
       throw std::runtime_error("Could not enumerate device extensions");
 
    for (auto& extension : extensions)
-      if (strcmp(extension.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0)
+      if (strcmp(extension.extensionName, extensionName) == 0)
          return true;
 
    return false;
@@ -626,12 +705,37 @@ SwapchainDetails VulkanRenderer::getSwapchainDetails(VkPhysicalDevice device, Vk
 }
 
 void VulkanRenderer::updateModelData(size_t index, const glm::mat4& transform, const PushModel& pushData)
+{
+   updateModelInstance(index, 0, transform, pushData);
+}
+
+uint32_t VulkanRenderer::addModelInstance(size_t index, const glm::mat4& transform, const PushModel& pushData)
+{
+   if (meshes.size() <= index)
+      throw std::runtime_error("Invalid model index");
+
+   uint32_t instanceId = meshes[index].addInstance(transform, pushData);
+   reserveObjectCapacity(getObjectCount());
+   invalidateRecordings();
+
+   return instanceId;
+}
+
+void VulkanRenderer::removeModelInstance(size_t index, uint32_t instanceId)
 {
    if (meshes.size() <= index)
       return;
 
-   meshes[index].setModel(transform);
-   meshes[index].setPushData(pushData);
+   if (meshes[index].removeInstance(instanceId))
+      invalidateRecordings();
+}
+
+void VulkanRenderer::updateModelInstance(size_t index, uint32_t instanceId, const glm::mat4& transform, const PushModel& pushData)
+{
+   if (meshes.size() <= index)
+      return;
+
+   meshes[index].updateInstance(instanceId, transform, pushData);
 }
 
 VkSurfaceFormatKHR VulkanRenderer::selectBestSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats) const
@@ -678,12 +782,9 @@ void VulkanRenderer::createGraphicsPipeline()
    VkGraphicsPipelineCreateInfo createInfo = {};
    createInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 
-   //shader modules
-   std::vector<char> vertexShader = readFile("shader.vert.spv");
-   std::vector<char> fragmentShader = readFile("shader.frag.spv");
-
-   VkShaderModule vertexShaderModule = createShaderModule(mainDevice.logicalDevice, vertexShader);
-   VkShaderModule fragmentShaderModule = createShaderModule(mainDevice.logicalDevice, fragmentShader);
+   //shader modules, owned by the library
+   VkShaderModule vertexShaderModule = shaderLibrary.get("shader.vert.spv");
+   VkShaderModule fragmentShaderModule = shaderLibrary.get(useBindlessTextures ? "bindless.frag.spv" : "shader.frag.spv");
 
    VkPipelineShaderStageCreateInfo vertexShaderCreateInfo = {};
    vertexShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -705,30 +806,33 @@ void VulkanRenderer::createGraphicsPipeline()
 
    VkVertexInputBindingDescription bindingDescription = {};
    bindingDescription.binding = 0;
-   bindingDescription.stride = sizeof(Vertex);
+   bindingDescription.stride = static_cast<uint32_t>(geometryPool.getVertexStride());
    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
+   //the same shader reads both formats, the normalized and half float attributes are converted to floats by the input assembler
+   bool packedVertices = vertexFormat == VertexFormat::packed;
+
    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
 
    VkVertexInputAttributeDescription positionVertexAttributeDescription = {};
    positionVertexAttributeDescription.binding = 0; //match bindingDescription.binding
    positionVertexAttributeDescription.location = 0; // layout location in shader
-   positionVertexAttributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-   positionVertexAttributeDescription.offset = offsetof(Vertex, Vertex::position);
+   positionVertexAttributeDescription.format = packedVertices ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+   positionVertexAttributeDescription.offset = packedVertices ? offsetof(PackedVertex, PackedVertex::position) : offsetof(Vertex, Vertex::position);
    attributeDescriptions.push_back(positionVertexAttributeDescription);
 
    VkVertexInputAttributeDescription colorVertexAttributeDescription = {};
    colorVertexAttributeDescription.binding = 0;
    colorVertexAttributeDescription.location = 1;
-   colorVertexAttributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-   colorVertexAttributeDescription.offset = offsetof(Vertex, Vertex::color);
+   colorVertexAttributeDescription.format = packedVertices ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R32G32B32_SFLOAT;
+   colorVertexAttributeDescription.offset = packedVertices ? offsetof(PackedVertex, PackedVertex::color) : offsetof(Vertex, Vertex::color);
    attributeDescriptions.push_back(colorVertexAttributeDescription);
 
    VkVertexInputAttributeDescription uvVertexAttributeDescription = {};
    uvVertexAttributeDescription.binding = 0;
    uvVertexAttributeDescription.location = 2;
-   uvVertexAttributeDescription.format = VK_FORMAT_R32G32_SFLOAT;
-   uvVertexAttributeDescription.offset = offsetof(Vertex, Vertex::uv);
+   uvVertexAttributeDescription.format = packedVertices ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+   uvVertexAttributeDescription.offset = packedVertices ? offsetof(PackedVertex, PackedVertex::uv) : offsetof(Vertex, Vertex::uv);
    attributeDescriptions.push_back(uvVertexAttributeDescription);
 
    VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
@@ -746,29 +850,17 @@ void VulkanRenderer::createGraphicsPipeline()
    inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
    createInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
 
-   //view port and scissor
-   VkViewport viewport = {};
-   viewport.x = 0;
-   viewport.y = 0;
-   viewport.width = static_cast<float>(currentResolution.width);
-   viewport.height = static_cast<float>(currentResolution.height);
-   viewport.minDepth = 0.0f;
-   viewport.maxDepth = 1.0f;
-
-   VkRect2D scissor = {};
-   scissor.offset = { 0, 0 };
-   scissor.extent = currentResolution;
-
+   //view port and scissor, set by recordCommandBuffers so the pipelines outlive a resize
    VkPipelineViewportStateCreateInfo viewportScissorCreateInfo = {};
    viewportScissorCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-   viewportScissorCreateInfo.pViewports = &viewport;
+   viewportScissorCreateInfo.pViewports = nullptr;
    viewportScissorCreateInfo.viewportCount = 1;
-   viewportScissorCreateInfo.pScissors = &scissor;
+   viewportScissorCreateInfo.pScissors = nullptr;
    viewportScissorCreateInfo.scissorCount = 1;
    createInfo.pViewportState = &viewportScissorCreateInfo;
 
    //dynamic state
-   std::vector<VkDynamicState> dynamicStates = {};
+   std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
    VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
    dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
    dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
@@ -822,13 +914,18 @@ void VulkanRenderer::createGraphicsPipeline()
    layoutCreateInfo.pSetLayouts = layouts; //sets in the shader
    layoutCreateInfo.setLayoutCount = 2; //number of sets in the shader
 
-   VkPushConstantRange pushConstantRange = {};
-   pushConstantRange.offset = 0;
-   pushConstantRange.size = sizeof(UboModel);
-   pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+   VkPushConstantRange pushConstants[2] = {};
+   pushConstants[0].offset = 0;
+   pushConstants[0].size = sizeof(PushMeshBounds);
+   pushConstants[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-   layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
-   layoutCreateInfo.pushConstantRangeCount = 1;
+   //the bindless fragment shader gets the texture index of the mesh after the bounds
+   pushConstants[1].offset = sizeof(PushMeshBounds);
+   pushConstants[1].size = sizeof(uint32_t);
+   pushConstants[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+   layoutCreateInfo.pPushConstantRanges = pushConstants;
+   layoutCreateInfo.pushConstantRangeCount = useBindlessTextures ? 2 : 1;
 
    if (VK_SUCCESS != vkCreatePipelineLayout(mainDevice.logicalDevice, &layoutCreateInfo, nullptr, &subPassAPipelineLayout))
       throw std::runtime_error("Unable to create pipeline layout");
@@ -853,22 +950,22 @@ void VulkanRenderer::createGraphicsPipeline()
    createInfo.basePipelineHandle = nullptr; //pointer to a pass, only override values in the new pass
    createInfo.basePipelineIndex = -1;
 
-   if (VK_SUCCESS != vkCreateGraphicsPipelines(mainDevice.logicalDevice, nullptr, 1, &createInfo, nullptr, &subPassAGraphicsPipeline))
+   //only the driver compile is timed, it is the part the pipeline cache saves
+   size_t cacheSizeBefore = pipelineCache.getDataSize();
+   auto compileStart = std::chrono::steady_clock::now();
+
+   if (VK_SUCCESS != vkCreateGraphicsPipelines(mainDevice.logicalDevice, pipelineCache.get(), 1, &createInfo, nullptr, &subPassAGraphicsPipeline))
       throw std::runtime_error("Failed to create pipeline");
 
-   vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
-   vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+   std::chrono::duration<double, std::milli> compileTime = std::chrono::steady_clock::now() - compileStart;
 
    //render pass B
 
    VkGraphicsPipelineCreateInfo createInfoPipelinB = createInfo;
 
    //shader modules
-   std::vector<char> secondVertexShader = readFile("second.vert.spv");
-   std::vector<char> secondFragmentShader = readFile("second.frag.spv");
-
-   VkShaderModule secondVertexShaderModule = createShaderModule(mainDevice.logicalDevice, secondVertexShader);
-   VkShaderModule secondFragmentShaderModule = createShaderModule(mainDevice.logicalDevice, secondFragmentShader);
+   VkShaderModule secondVertexShaderModule = shaderLibrary.get("second.vert.spv");
+   VkShaderModule secondFragmentShaderModule = shaderLibrary.get("second.frag.spv");
 
    vertexShaderCreateInfo.module = secondVertexShaderModule;
    fragmentShaderCreateInfo.module = secondFragmentShaderModule;
@@ -904,11 +1001,18 @@ void VulkanRenderer::createGraphicsPipeline()
 
    createInfoPipelinB.subpass = 1;
 
-   if (VK_SUCCESS != vkCreateGraphicsPipelines(mainDevice.logicalDevice, nullptr, 1, &createInfoPipelinB, nullptr, &subPassBGraphicsPipeline))
+   compileStart = std::chrono::steady_clock::now();
+
+   if (VK_SUCCESS != vkCreateGraphicsPipelines(mainDevice.logicalDevice, pipelineCache.get(), 1, &createInfoPipelinB, nullptr, &subPassBGraphicsPipeline))
       throw std::runtime_error("Failed to create pipeline");
 
-   vkDestroyShaderModule(mainDevice.logicalDevice, secondVertexShaderModule, nullptr);
-   vkDestroyShaderModule(mainDevice.logicalDevice, secondFragmentShaderModule, nullptr);
+   compileTime += std::chrono::steady_clock::now() - compileStart;
+
+   //the driver only adds data for the pipelines it had to compile, written right away so a crash does not lose them
+   bool cacheHit = pipelineCache.getDataSize() == cacheSizeBefore;
+   printf("pipelines created in %.2f ms, pipeline cache %s\n", compileTime.count(), cacheHit ? "hit" : "miss");
+   if (!cacheHit)
+      pipelineCache.save();
 }
 
 void VulkanRenderer::createRenderPass()
@@ -1040,14 +1144,18 @@ void VulkanRenderer::createRenderPass()
 
 void VulkanRenderer::createFrameBuffers()
 {
-   swapChainFramebuffers.resize(swapChainImages.size());
+   //the color and depth attachments belong to the frame, only the last one to the swapchain image
+   swapChainFramebuffers.resize(framesInFlight * swapChainImages.size());
 
    for (size_t i = 0; i < swapChainFramebuffers.size(); ++i)
    {
+      size_t frame = i / swapChainImages.size();
+      size_t imageIndex = i % swapChainImages.size();
+
       std::vector<VkImageView> attachments;
-      attachments.push_back(colorBuffers[i].imageView); //same order as in the render pass
-      attachments.push_back(depthBuffers[i].imageView);
-      attachments.push_back(swapChainImages[i].imageView);
+      attachments.push_back(colorBuffers[frame].imageView); //same order as in the render pass
+      attachments.push_back(depthBuffers[frame].imageView);
+      attachments.push_back(swapChainImages[imageIndex].imageView);
 
       VkFramebufferCreateInfo createInfo = {};
       createInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1065,27 +1173,144 @@ void VulkanRenderer::createFrameBuffers()
 
 void VulkanRenderer::createCommandPool()
 {
+   //the upload buffers are allocated for one submit and freed when their ticket is retired, the frame buffers get their own pools
    VkCommandPoolCreateInfo createInfo = {};
    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-   createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+   createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
    createInfo.queueFamilyIndex = queueFamilyIndices.graphicFamily;
    
-   if (VK_SUCCESS != vkCreateCommandPool(mainDevice.logicalDevice, &createInfo, nullptr, &graphicsCommandPool))
-      throw std::runtime_error("Unable to create the command pool");
+   if (VK_SUCCESS != vkCreateCommandPool(mainDevice.logicalDevice, &createInfo, nullptr, &uploadCommandPool))
+      throw std::runtime_error("Unable to create the upload command pool");
+
+   createInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+
+   if (VK_SUCCESS != vkCreateCommandPool(mainDevice.logicalDevice, &createInfo, nullptr, &transferCommandPool))
+      throw std::runtime_error("Unable to create the transfer command pool");
+
+   uploadQueues.transferQueue = transferQueue;
+   uploadQueues.transferCommandPool = transferCommandPool;
+   uploadQueues.transferFamily = queueFamilyIndices.transferFamily;
+   uploadQueues.graphicsQueue = graphicsQueue;
+   uploadQueues.graphicsCommandPool = uploadCommandPool;
+   uploadQueues.graphicsFamily = queueFamilyIndices.graphicFamily;
+   uploadQueues.copyTimeline = &copyTimeline;
+   uploadQueues.uploadTimeline = &uploadTimeline;
 }
 
 void VulkanRenderer::allocateCommandBuffers()
 {
-   commandBuffers.resize(swapChainFramebuffers.size());
+   //a pool per recording slot, no buffer is ever reset on its own
+   VkCommandPoolCreateInfo createInfo = {};
+   createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   createInfo.queueFamilyIndex = queueFamilyIndices.graphicFamily;
+
+   frameCommandPools.resize(swapChainFramebuffers.size(), VK_NULL_HANDLE);
+   commandBuffers.resize(swapChainFramebuffers.size(), VK_NULL_HANDLE);
+   for (size_t i = 0; i < frameCommandPools.size(); ++i)
+   {
+      if (VK_SUCCESS != vkCreateCommandPool(mainDevice.logicalDevice, &createInfo, nullptr, &frameCommandPools[i]))
+         throw std::runtime_error("Unable to create the frame command pool");
 
-   VkCommandBufferAllocateInfo allocInfo = {};
-   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-   allocInfo.commandPool = graphicsCommandPool;
-   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-   allocInfo.commandBufferCount = static_cast<uint32_t>(swapChainFramebuffers.size());
+      VkCommandBufferAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = frameCommandPools[i];
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandBufferCount = 1;
 
-   if (VK_SUCCESS != vkAllocateCommandBuffers(mainDevice.logicalDevice, &allocInfo, commandBuffers.data()))
-      throw std::runtime_error("Failed to allocate command buffers");
+      if (VK_SUCCESS != vkAllocateCommandBuffers(mainDevice.logicalDevice, &allocInfo, &commandBuffers[i]))
+         throw std::runtime_error("Failed to allocate command buffers");
+   }
+
+   recordedVersions.assign(commandBuffers.size(), 0);
+   imageFrameValues.assign(swapChainImages.size(), 0);
+
+   createRecordingPools();
+}
+
+void VulkanRenderer::destroyCommandBuffers()
+{
+   destroyRecordingPools();
+
+   //the primary buffers go with their pools
+   for (auto& pool : frameCommandPools)
+   {
+      if (pool != VK_NULL_HANDLE)
+         vkDestroyCommandPool(mainDevice.logicalDevice, pool, nullptr);
+   }
+   frameCommandPools.clear();
+   commandBuffers.clear();
+   recordedVersions.clear();
+   imageFrameValues.clear();
+}
+
+size_t VulkanRenderer::getRecordingSlot(size_t frame, uint32_t imageIndex) const
+{
+   //the same order as the framebuffers
+   return frame * swapChainImages.size() + imageIndex;
+}
+
+void VulkanRenderer::createRecordingPools()
+{
+   //one pool and secondary buffer for every recording thread of every recording slot, reset as a whole before each recording
+   VkCommandPoolCreateInfo createInfo = {};
+   createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+   createInfo.queueFamilyIndex = queueFamilyIndices.graphicFamily;
+
+   recordingPools.resize(commandBuffers.size() * recordingThreadCount, VK_NULL_HANDLE);
+   secondaryCommandBuffers.resize(recordingPools.size(), VK_NULL_HANDLE);
+   for (size_t i = 0; i < recordingPools.size(); ++i)
+   {
+      if (VK_SUCCESS != vkCreateCommandPool(mainDevice.logicalDevice, &createInfo, nullptr, &recordingPools[i]))
+         throw std::runtime_error("Unable to create the recording command pool");
+
+      VkCommandBufferAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = recordingPools[i];
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      allocInfo.commandBufferCount = 1;
+
+      if (VK_SUCCESS != vkAllocateCommandBuffers(mainDevice.logicalDevice, &allocInfo, &secondaryCommandBuffers[i]))
+         throw std::runtime_error("Failed to allocate secondary command buffers");
+   }
+}
+
+void VulkanRenderer::destroyRecordingPools()
+{
+   //the secondary buffers go with their pools
+   for (auto& pool : recordingPools)
+   {
+      if (pool != VK_NULL_HANDLE)
+         vkDestroyCommandPool(mainDevice.logicalDevice, pool, nullptr);
+   }
+   recordingPools.clear();
+   secondaryCommandBuffers.clear();
+}
+
+void VulkanRenderer::setRecordingThreadCount(uint32_t threadCount)
+{
+   if (threadCount == recordingThreadCount)
+      return;
+
+   //before init only the count is kept, allocateCommandBuffers creates the pools
+   if (commandBuffers.empty())
+   {
+      recordingThreadCount = threadCount;
+      return;
+   }
+
+   vkDeviceWaitIdle(mainDevice.logicalDevice);
+   destroyRecordingPools();
+   recordingThreadCount = threadCount;
+   createRecordingPools();
+
+   //the old recordings execute secondary buffers that are gone
+   invalidateRecordings();
+}
+
+const std::vector<double>& VulkanRenderer::getRecordingTimes() const
+{
+   return recordingTimes;
 }
 
 void VulkanRenderer::createSyncronization()
@@ -1093,13 +1318,9 @@ void VulkanRenderer::createSyncronization()
    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-   VkFenceCreateInfo fenceCreateInfo = {};
-   fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-   fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-   imagesAvailable.resize(MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT);
-   rendersFinished.resize(MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT);
-   for (size_t i = 0; i < MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT; ++i)
+   imagesAvailable.resize(framesInFlight);
+   rendersFinished.resize(framesInFlight);
+   for (size_t i = 0; i < framesInFlight; ++i)
    {
       if (VK_SUCCESS != vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imagesAvailable[i]))
          throw std::runtime_error("Unable to create image semaphore");
@@ -1108,19 +1329,71 @@ void VulkanRenderer::createSyncronization()
          throw std::runtime_error("Unable to create render semaphore");
    }
 
-   drawFences.resize(MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT);
-   for (size_t i = 0; i < MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT; ++i)
+   //the frames are tracked on the frame timeline, 0 is reached before anything is submitted
+   frameValues.assign(framesInFlight, 0);
+}
+
+void VulkanRenderer::destroySyncronization()
+{
+   for (size_t i = 0; i < imagesAvailable.size(); ++i)
    {
-      if (VK_SUCCESS != vkCreateFence(mainDevice.logicalDevice, &fenceCreateInfo, nullptr, &drawFences[i]))
-         throw std::runtime_error("Unable to create fence");
+      if (imagesAvailable[i] != VK_NULL_HANDLE)
+         vkDestroySemaphore(mainDevice.logicalDevice, imagesAvailable[i], nullptr);
    }
+   imagesAvailable.clear();
+
+   for (size_t i = 0; i < rendersFinished.size(); ++i)
+   {
+      if (rendersFinished[i] != VK_NULL_HANDLE)
+         vkDestroySemaphore(mainDevice.logicalDevice, rendersFinished[i], nullptr);
+   }
+   rendersFinished.clear();
+   frameValues.clear();
+}
+
+void VulkanRenderer::setFramesInFlight(uint32_t frameCount)
+{
+   frameCount = std::min(std::max(frameCount, 1u), MAX_FRAMES_IN_FLIGHT);
+   if (frameCount == framesInFlight)
+      return;
+
+   //before init only the count is kept
+   if (imagesAvailable.empty())
+   {
+      framesInFlight = frameCount;
+      return;
+   }
+
+   vkDeviceWaitIdle(mainDevice.logicalDevice);
+   destroySyncronization();
+   cleanupAfterResize();
+
+   framesInFlight = frameCount;
+   currentFrame = 0;
+
+   createSyncronization();
+   createUniformBuffers();
+   initAfterResize();
+
+   //the ring partitions and attachments the recordings used are gone
+   invalidateRecordings();
+}
+
+uint32_t VulkanRenderer::getFramesInFlight() const
+{
+   return framesInFlight;
+}
+
+void VulkanRenderer::setCookTexturesOnLoad(bool cook)
+{
+   cookTexturesOnLoad = cook;
 }
 
 void VulkanRenderer::createSubPassASamplerDescriptorSetLayout()
 {
    VkDescriptorSetLayoutBinding samplerBinding = {};
    samplerBinding.binding = 0;//shader binding
-   samplerBinding.descriptorCount = 1;
+   samplerBinding.descriptorCount = useBindlessTextures ? bindlessTextureCapacity : 1;
    samplerBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
    samplerBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;//stage where to bind
 
@@ -1129,6 +1402,19 @@ void VulkanRenderer::createSubPassASamplerDescriptorSetLayout()
    createInfo.bindingCount = 1;
    createInfo.pBindings = &samplerBinding;
 
+   //the elements of released handles stay stale, they are not read until a new texture is written there
+   VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+   VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo = {};
+   bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+   bindingFlagsCreateInfo.bindingCount = 1;
+   bindingFlagsCreateInfo.pBindingFlags = &bindingFlags;
+
+   if (useBindlessTextures)
+   {
+      createInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+      createInfo.pNext = &bindingFlagsCreateInfo;
+   }
+
    if (VK_SUCCESS != vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &createInfo, nullptr, &samplerDescriptorSetLayout))
       throw std::runtime_error("Unable to create sampler descriptor set layout");
 }
@@ -1138,13 +1424,13 @@ void VulkanRenderer::createSubPassADescriptorSetLayout()
    VkDescriptorSetLayoutBinding vpBinding = {};
    vpBinding.binding = 0;//shader binding
    vpBinding.descriptorCount = 1;
-   vpBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+   vpBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
    vpBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;//stage where to bind
 
    VkDescriptorSetLayoutBinding modelBinding = {};
    modelBinding.binding = 1;//shader binding
    modelBinding.descriptorCount = 1;
-   modelBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+   modelBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
    modelBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;//stage where to bind
 
    VkDescriptorSetLayoutBinding bindings[] = { vpBinding, modelBinding };
@@ -1185,37 +1471,113 @@ void VulkanRenderer::createSubPassBDescriptorSetLayout()
 }
 
 void VulkanRenderer::createSamplerDescriptorPool()
+{
+   VkDescriptorPool pool = addSamplerDescriptorPool();
+
+   if (useBindlessTextures)
+   {
+      VkDescriptorSetAllocateInfo descriptorSetAllocationInfo = {};
+      descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      descriptorSetAllocationInfo.descriptorPool = pool;
+      descriptorSetAllocationInfo.descriptorSetCount = 1;
+      descriptorSetAllocationInfo.pSetLayouts = &samplerDescriptorSetLayout;
+
+      if (VK_SUCCESS != vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, &bindlessTextureSet))
+         throw std::runtime_error("Unable to allocate the bindless texture descriptors");
+   }
+}
+
+VkDescriptorPool VulkanRenderer::addSamplerDescriptorPool()
 {
    VkDescriptorPoolSize samplerPoolSize = {};
    samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-   samplerPoolSize.descriptorCount = static_cast<uint32_t>(MAX_TEXTURES); //nr of descriptors, not sets
+   samplerPoolSize.descriptorCount = TEXTURES_PER_SAMPLER_POOL; //nr of descriptors, not sets
 
    VkDescriptorPoolCreateInfo poolCreateInfo = {};
    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
    poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-   poolCreateInfo.maxSets = static_cast<uint32_t>(MAX_TEXTURES);
+   poolCreateInfo.maxSets = TEXTURES_PER_SAMPLER_POOL;
    poolCreateInfo.poolSizeCount = 1;
    poolCreateInfo.pPoolSizes = &samplerPoolSize;
-   if (VK_SUCCESS != vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &subPassASamplerDescriptorPool))
+
+   //a single set holds the whole array
+   if (useBindlessTextures)
+   {
+      samplerPoolSize.descriptorCount = bindlessTextureCapacity;
+      poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+      poolCreateInfo.maxSets = 1;
+   }
+
+   VkDescriptorPool pool = VK_NULL_HANDLE;
+   if (VK_SUCCESS != vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &pool))
       throw std::runtime_error("Unable to create descriptor set pool");
+
+   samplerDescriptorPools.push_back(pool);
+   return pool;
 }
 
-void VulkanRenderer::crateSubPassABufferDescriptorSetPool()
+VkDescriptorSet VulkanRenderer::allocateTextureSamplerSet(VkDescriptorPool* pool)
+{
+   VkDescriptorSetAllocateInfo descriptorSetAllocationInfo = {};
+   descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+   descriptorSetAllocationInfo.descriptorSetCount = 1;
+   descriptorSetAllocationInfo.pSetLayouts = &samplerDescriptorSetLayout;
+
+   //the newest pool is the most likely to have room, the sets of released textures go back to the older ones
+   VkDescriptorSet out = VK_NULL_HANDLE;
+   for (auto i = samplerDescriptorPools.rbegin(); i != samplerDescriptorPools.rend(); ++i)
+   {
+      descriptorSetAllocationInfo.descriptorPool = *i;
+      if (VK_SUCCESS == vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, &out))
+      {
+         *pool = *i;
+         return out;
+      }
+   }
+
+   descriptorSetAllocationInfo.descriptorPool = addSamplerDescriptorPool();
+   if (VK_SUCCESS != vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, &out))
+      throw std::runtime_error("Unable to allocate descriptors for samplers");
+
+   *pool = descriptorSetAllocationInfo.descriptorPool;
+   return out;
+}
+
+void VulkanRenderer::writeTextureDescriptor(VkDescriptorSet set, uint32_t arrayElement, VkImageView imageView)
 {
-   VkDescriptorPoolSize uboPoolSize = {};
-   uboPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-   uboPoolSize.descriptorCount = static_cast<uint32_t>(uboBuffers.size()); //nr of descriptors, not sets
+   VkDescriptorImageInfo imageInfo = {};
+   imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+   imageInfo.imageView = imageView;
+   imageInfo.sampler = textureSampler;
+
+   VkWriteDescriptorSet writeDescriptorSet = {};
+   writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+   writeDescriptorSet.descriptorCount = 1;
+   writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+   writeDescriptorSet.dstBinding = 0;
+   writeDescriptorSet.dstArrayElement = arrayElement;
+   writeDescriptorSet.pImageInfo = &imageInfo;
+   writeDescriptorSet.dstSet = set;
+   vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
+}
 
+void VulkanRenderer::crateSubPassABufferDescriptorSetPool()
+{
+   //the set is replaced when the object ring grows, the old ones live until the frames using them complete
    VkDescriptorPoolSize dynamicUboPoolSize = {};
-   dynamicUboPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
-   dynamicUboPoolSize.descriptorCount = static_cast<uint32_t>(dynamicUboBuffers.size());
+   dynamicUboPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+   dynamicUboPoolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT + 1; //nr of descriptors, not sets
+
+   VkDescriptorPoolSize objectsPoolSize = {};
+   objectsPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+   objectsPoolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT + 1;
 
-   VkDescriptorPoolSize renderPassAPoolSizes[] = { uboPoolSize , dynamicUboPoolSize };
+   VkDescriptorPoolSize renderPassAPoolSizes[] = { dynamicUboPoolSize , objectsPoolSize };
 
    VkDescriptorPoolCreateInfo renderPassAPoolCreateInfo = {};
    renderPassAPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
    renderPassAPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-   renderPassAPoolCreateInfo.maxSets = static_cast<uint32_t>(uboBuffers.size()) + static_cast<uint32_t>(dynamicUboBuffers.size());
+   renderPassAPoolCreateInfo.maxSets = MAX_FRAMES_IN_FLIGHT + 1;
    renderPassAPoolCreateInfo.poolSizeCount = 2;
    renderPassAPoolCreateInfo.pPoolSizes = renderPassAPoolSizes;
    if (VK_SUCCESS != vkCreateDescriptorPool(mainDevice.logicalDevice, &renderPassAPoolCreateInfo, nullptr, &subPassABufferDescriptorPool))
@@ -1224,20 +1586,21 @@ void VulkanRenderer::crateSubPassABufferDescriptorSetPool()
 
 void VulkanRenderer::crateSubPassBInputDescriptorSetPool()
 {
+   //sized for the most frames in flight, so changing their count does not need another pool
    VkDescriptorPoolSize colorInputPoolSize = {};
    colorInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-   colorInputPoolSize.descriptorCount = static_cast<uint32_t>(colorBuffers.size());
+   colorInputPoolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT;
 
    VkDescriptorPoolSize depthInputPoolSize = {};
    depthInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-   depthInputPoolSize.descriptorCount = static_cast<uint32_t>(depthBuffers.size());
+   depthInputPoolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT;
 
    VkDescriptorPoolSize renderPassBPoolSizes[] = { colorInputPoolSize , depthInputPoolSize };
 
    VkDescriptorPoolCreateInfo renderPassBPoolCreateInfo = {};
    renderPassBPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
    renderPassBPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-   renderPassBPoolCreateInfo.maxSets = static_cast<uint32_t>(colorBuffers.size()) + static_cast<uint32_t>(depthBuffers.size());
+   renderPassBPoolCreateInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
    renderPassBPoolCreateInfo.poolSizeCount = 2;
    renderPassBPoolCreateInfo.pPoolSizes = renderPassBPoolSizes;
    if (VK_SUCCESS != vkCreateDescriptorPool(mainDevice.logicalDevice, &renderPassBPoolCreateInfo, nullptr, &subPassBInputsDescriptorPool))
@@ -1246,59 +1609,78 @@ void VulkanRenderer::crateSubPassBInputDescriptorSetPool()
 
 void VulkanRenderer::createSubPassABufferDescriptorSet()
 {
-   std::vector<VkDescriptorSetLayout> layouts(std::max(uboBuffers.size(), dynamicUboBuffers.size()), subPassADescriptorSetLayout); //one per allocated set !
+   //a previous set may still be used by the frames in flight
+   if (subPassABufferDescriptorSet != VK_NULL_HANDLE)
+   {
+      VkDescriptorSet retired = subPassABufferDescriptorSet;
+      deletionQueue.push(frameTimeline.getLastSubmitted(), [this, retired]() {
+         vkFreeDescriptorSets(mainDevice.logicalDevice, subPassABufferDescriptorPool, 1, &retired);
+      });
+      subPassABufferDescriptorSet = VK_NULL_HANDLE;
+   }
 
    //ubo descriptor set allocation
    {
       VkDescriptorSetAllocateInfo descriptorSetAllocationInfo = {};
       descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
       descriptorSetAllocationInfo.descriptorPool = subPassABufferDescriptorPool;
-      descriptorSetAllocationInfo.descriptorSetCount = static_cast<uint32_t>(uboBuffers.size());
-      descriptorSetAllocationInfo.pSetLayouts = layouts.data();
-
-      subPassABufferDescriptorSets.resize(static_cast<uint32_t>(uboBuffers.size()));
-      if (VK_SUCCESS != vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, subPassABufferDescriptorSets.data()))
-         throw std::runtime_error("Unable to allocate descriptors for ubo");
+      descriptorSetAllocationInfo.descriptorSetCount = 1;
+      descriptorSetAllocationInfo.pSetLayouts = &subPassADescriptorSetLayout;
 
-      //bind the buffers to descriptors
-      for (size_t i = 0; i < uboBuffers.size(); ++i)
+      if (VK_SUCCESS != vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, &subPassABufferDescriptorSet))
       {
-         VkDescriptorBufferInfo uboBufferInfo = {};
-         uboBufferInfo.buffer = uboBuffers[i];
-         uboBufferInfo.offset = 0;
-         uboBufferInfo.range = sizeof(UboViewProjection);
-
-         VkWriteDescriptorSet mvpDescriptorSet = {};
-         mvpDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-         mvpDescriptorSet.dstSet = subPassABufferDescriptorSets[i];
-         mvpDescriptorSet.dstBinding = 0; //binding from layout or shader
-         mvpDescriptorSet.dstArrayElement = 0; //index if this is an array
-         mvpDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-         mvpDescriptorSet.descriptorCount = 1;
-         mvpDescriptorSet.pBufferInfo = &uboBufferInfo;
-
-
-         VkDescriptorBufferInfo dynamicBufferInfo = {};
-         dynamicBufferInfo.buffer = dynamicUboBuffers[i];
-         dynamicBufferInfo.offset = 0;
-         dynamicBufferInfo.range = modelUniformAlignment; // for dynamic object we pass the size of an abject not of the whole buffer
-
-         VkWriteDescriptorSet modelDescriptorSet = {};
-         modelDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-         modelDescriptorSet.dstSet = subPassABufferDescriptorSets[i];
-         modelDescriptorSet.dstBinding = 1; //binding from layout or shader
-         modelDescriptorSet.dstArrayElement = 0;
-         modelDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-         modelDescriptorSet.descriptorCount = 1;
-         modelDescriptorSet.pBufferInfo = &dynamicBufferInfo;
-
-         VkWriteDescriptorSet setWrites[] = { mvpDescriptorSet, modelDescriptorSet };
-
-         vkUpdateDescriptorSets(mainDevice.logicalDevice, 2, setWrites, 0, nullptr);
+         //the pool is full of retired sets, wait for the frames using them
+         frameTimeline.wait(frameTimeline.getLastSubmitted());
+         deletionQueue.collect(frameTimeline.getCompleted());
+
+         if (VK_SUCCESS != vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, &subPassABufferDescriptorSet))
+            throw std::runtime_error("Unable to allocate descriptors for ubo");
       }
+
+      //bind the ring buffers to descriptors, the dynamic offsets select the frame partition
+      writeUniformDescriptor();
+      writeObjectDescriptor();
    }
 }
 
+void VulkanRenderer::writeUniformDescriptor()
+{
+   VkDescriptorBufferInfo uboBufferInfo = {};
+   uboBufferInfo.buffer = uniformRing.getBuffer();
+   uboBufferInfo.offset = 0;
+   uboBufferInfo.range = sizeof(UboViewProjection);
+
+   VkWriteDescriptorSet mvpDescriptorSet = {};
+   mvpDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+   mvpDescriptorSet.dstSet = subPassABufferDescriptorSet;
+   mvpDescriptorSet.dstBinding = 0; //binding from layout or shader
+   mvpDescriptorSet.dstArrayElement = 0; //index if this is an array
+   mvpDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+   mvpDescriptorSet.descriptorCount = 1;
+   mvpDescriptorSet.pBufferInfo = &uboBufferInfo;
+
+   vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &mvpDescriptorSet, 0, nullptr);
+}
+
+void VulkanRenderer::writeObjectDescriptor()
+{
+   VkDescriptorBufferInfo objectsBufferInfo = {};
+   objectsBufferInfo.buffer = objectRing->getBuffer();
+   objectsBufferInfo.offset = 0;
+   objectsBufferInfo.range = objectRing->getFrameSize(); // the whole partition of a frame, the shader indexes it
+
+   VkWriteDescriptorSet objectsDescriptorSet = {};
+   objectsDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+   objectsDescriptorSet.dstSet = subPassABufferDescriptorSet;
+   objectsDescriptorSet.dstBinding = 1; //binding from layout or shader
+   objectsDescriptorSet.dstArrayElement = 0;
+   objectsDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+   objectsDescriptorSet.descriptorCount = 1;
+   objectsDescriptorSet.pBufferInfo = &objectsBufferInfo;
+
+   vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &objectsDescriptorSet, 0, nullptr);
+}
+
 void VulkanRenderer::createSubPassBInputDescriptorSet()
 {
    std::vector<VkDescriptorSetLayout> layouts(colorBuffers.size(), subPassBDescriptorSetLayout); //one per allocated set !
@@ -1309,7 +1691,7 @@ void VulkanRenderer::createSubPassBInputDescriptorSet()
    descriptorSetAllocationInfo.descriptorSetCount = static_cast<uint32_t>(colorBuffers.size());
    descriptorSetAllocationInfo.pSetLayouts = layouts.data();
 
-   subPassBInputDescriptorSets.resize(static_cast<uint32_t>(uboBuffers.size()));
+   subPassBInputDescriptorSets.resize(static_cast<uint32_t>(colorBuffers.size()));
    if (VK_SUCCESS != vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, subPassBInputDescriptorSets.data()))
       throw std::runtime_error("Unable to allocate descriptors for inputs on subpass 2");
 
@@ -1351,38 +1733,59 @@ void VulkanRenderer::createSubPassBInputDescriptorSet()
 
 void VulkanRenderer::createUniformBuffers()
 {
-   //uniform buffer objects
-   for (size_t i = 0; i < swapChainImages.size(); ++i)
-   {
-      VkBuffer out = VK_NULL_HANDLE;
-      VkDeviceMemory outMemory = VK_NULL_HANDLE;
-      creteBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, sizeof(UboViewProjection),
-         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-         &out, &outMemory);
+   //one ring partition per frame in flight, called again when their count changes
+   uniformRing.cleanup();
+   uniformRing.init(&memoryAllocator, mainDevice.logicalDevice, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      mainDevice.minUniformBufferOffsetAlignment, framesInFlight,
+      sizeof(UboViewProjection));
 
-      uboBuffers.push_back(out);
-      uboBuffersMemory.push_back(outMemory);
-   }
+   if (subPassABufferDescriptorSet != VK_NULL_HANDLE)
+      writeUniformDescriptor();
 
-   //dynamic uniform buffer objects
-   for (size_t i = 0; i < swapChainImages.size(); ++i)
-   {
-      VkBuffer out = VK_NULL_HANDLE;
-      VkDeviceMemory outMemory = VK_NULL_HANDLE;
-      creteBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelUniformAlignment * MAX_OBJECTS,
-         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-         &out, &outMemory);
+   createObjectRing(std::max(objectCapacity, INITIAL_OBJECT_CAPACITY));
+}
+
+size_t VulkanRenderer::getObjectCount() const
+{
+   size_t out = 0;
+   for (const auto& model : meshes)
+      out += model.getInstanceCount();
+
+   return out;
+}
 
-      dynamicUboBuffers.push_back(out);
-      dynamicUboBuffersMemory.push_back(outMemory);
+void VulkanRenderer::reserveObjectCapacity(size_t objectCount)
+{
+   if (objectCount <= objectCapacity)
+      return;
+
+   size_t newCapacity = std::max(objectCount, std::max(objectCapacity * 2, INITIAL_OBJECT_CAPACITY));
+   createObjectRing(newCapacity);
+}
+
+void VulkanRenderer::createObjectRing(size_t capacity)
+{
+   //the old buffer may still be read by the frames in flight, it is destroyed once they complete
+   if (objectRing)
+   {
+      std::shared_ptr<FrameRingBuffer> retired = std::move(objectRing);
+      deletionQueue.push(frameTimeline.getLastSubmitted(), [retired]() { retired->cleanup(); });
    }
+
+   objectRing = std::make_unique<FrameRingBuffer>();
+   objectRing->init(&memoryAllocator, mainDevice.logicalDevice, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      mainDevice.minStorageBufferOffsetAlignment, framesInFlight,
+      capacity * sizeof(ObjectData));
+   objectCapacity = capacity;
+
+   //the bound set can not be updated while it is in use, the callers invalidate the recordings
+   if (subPassABufferDescriptorSet != VK_NULL_HANDLE)
+      createSubPassABufferDescriptorSet();
 }
 
 void VulkanRenderer::createDepthBuffer()
 {
-   depthBuffers.resize(swapChainImages.size());
+   depthBuffers.resize(framesInFlight);
    for (auto& depthBuffer : depthBuffers)
    {
       depthBuffer.image = createImage(currentResolution.width, currentResolution.height, depthBufferFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBuffer.deviceMemory);
@@ -1393,7 +1796,7 @@ void VulkanRenderer::createDepthBuffer()
 
 void VulkanRenderer::createColorBuffer()
 {
-   colorBuffers.resize(swapChainImages.size());
+   colorBuffers.resize(framesInFlight);
    for (auto& colorBuffer : colorBuffers)
    {
       colorBuffer.image = createImage(currentResolution.width, currentResolution.height, colorBufferFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorBuffer.deviceMemory);
@@ -1405,28 +1808,32 @@ void VulkanRenderer::createColorBuffer()
 VkFormat VulkanRenderer::choseOptimalImageFormat(const std::vector<VkFormat> formats, VkImageTiling tiling, VkFormatFeatureFlags flags) const
 {
    for (auto& format : formats)
-   {
-      VkFormatProperties properties = {};
-      vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, format, &properties);
-
-      VkFormatFeatureFlags currentFlags = properties.linearTilingFeatures;
-      if (tiling == VK_IMAGE_TILING_OPTIMAL)
-         currentFlags = properties.optimalTilingFeatures;
-
-      if ((currentFlags & flags) == flags)
+      if (isImageFormatSupported(format, tiling, flags))
          return format;
-   }
+
    throw std::runtime_error("Failed to find a maching format");
 }
 
+bool VulkanRenderer::isImageFormatSupported(VkFormat format, VkImageTiling tiling, VkFormatFeatureFlags flags) const
+{
+   VkFormatProperties properties = {};
+   vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, format, &properties);
+
+   VkFormatFeatureFlags currentFlags = properties.linearTilingFeatures;
+   if (tiling == VK_IMAGE_TILING_OPTIMAL)
+      currentFlags = properties.optimalTilingFeatures;
+
+   return (currentFlags & flags) == flags;
+}
+
 VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format,
-   VkImageTiling tiling, VkImageUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags, VkDeviceMemory* imageMemory) const
+   VkImageTiling tiling, VkImageUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags, MemoryAllocation* imageMemory, uint32_t mipLevels)
 {
    VkImageCreateInfo imageCreateInfo = {};
    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
    imageCreateInfo.extent = { width, height, 1 };
-   imageCreateInfo.mipLevels = 1;
+   imageCreateInfo.mipLevels = mipLevels;
    imageCreateInfo.arrayLayers = 1;
    imageCreateInfo.format = format;
    imageCreateInfo.tiling = tiling;
@@ -1442,15 +1849,10 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
    VkMemoryRequirements imageMemoryRequierments = {};
    vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &imageMemoryRequierments);
 
-   VkMemoryAllocateInfo memoryAllocateInfo = {};
-   memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-   memoryAllocateInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, imageMemoryRequierments.memoryTypeBits, propertyFlags);
-   memoryAllocateInfo.allocationSize = imageMemoryRequierments.size;
-   
-   if (VK_SUCCESS != vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocateInfo, nullptr, imageMemory))
-      throw std::runtime_error("Unable to allocate image memory");
+   *imageMemory = memoryAllocator.allocate(imageMemoryRequierments, propertyFlags,
+      tiling == VK_IMAGE_TILING_OPTIMAL ? AllocationKind::optimal : AllocationKind::linear);
 
-   if (VK_SUCCESS != vkBindImageMemory(mainDevice.logicalDevice, image, *imageMemory, 0))
+   if (VK_SUCCESS != vkBindImageMemory(mainDevice.logicalDevice, image, imageMemory->memory, imageMemory->offset))
       throw std::runtime_error("Unable to allocate image memory");
 
    return image;
@@ -1458,123 +1860,263 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 
 void VulkanRenderer::updateUniformBuffers(size_t frame)
 {
-   //update ubo
-   void* outData = nullptr;
-   if (VK_SUCCESS != vkMapMemory(mainDevice.logicalDevice, uboBuffersMemory[frame], 0, sizeof(UboViewProjection), 0, &outData))
-      throw std::runtime_error("Unable to map ubo buffer");
+   //written straight into the persistently mapped partition of this frame
+   uniformRing.beginFrame(static_cast<uint32_t>(frame));
+   uniformRing.push(uboViewProjection);
 
-   memcpy(outData, &uboViewProjection, sizeof(UboViewProjection));
+   uniformRing.flush();
 
-   vkUnmapMemory(mainDevice.logicalDevice, uboBuffersMemory[frame]);
-   outData = nullptr;
+   //object records, in the drawing order
+   objectRing->beginFrame(static_cast<uint32_t>(frame));
+
+   size_t objectCount = getObjectCount();
+   if (objectCount == 0)
+      return;
 
-   //update dynamic uniform buffers object, in the drawing order
-   size_t meshaesCount = 0;
-   for (size_t i = 0; i < meshes.size(); ++i)
+   //one record per instance, every mesh of a model draws the same range
+   void* objectsData = nullptr;
+   objectRing->allocate(objectCount * sizeof(ObjectData), &objectsData);
+   ObjectData* objects = reinterpret_cast<ObjectData*>(objectsData);
+
+   //all the meshes of a model share the instances of the model
+   for (const auto& model : meshes)
    {
-      UboModel uboModel;
-      uboModel.model = meshes[i].getModel();
+      memcpy(objects, model.getInstances().data(), model.getInstanceCount() * sizeof(ObjectData));
+      objects += model.getInstanceCount();
+   }
+
+   objectRing->flush();
+}
+
+uint32_t VulkanRenderer::loadTexture(const char* imageFileName)
+{
+   UploadBatch uploadBatch(&memoryAllocator, mainDevice.logicalDevice, uploadQueues);
+   uint32_t out = loadTexture(imageFileName, uploadBatch);
+   pendingUploads.emplace_back(uploadBatch.submit());
+
+   return out;
+}
 
-      for (size_t m = 0; m < meshes[i].getMeshCount(); ++m)
+void VulkanRenderer::unloadTexture(uint32_t handle)
+{
+   //the frames submitted so far may still sample it, the reference is dropped once they are done
+   //an upload submitted after them may still write it, that one is almost always done by then
+   uint64_t uploadValue = uploadTimeline.getLastSubmitted();
+   deletionQueue.push(frameTimeline.getLastSubmitted(), [this, handle, uploadValue]()
       {
-         if (meshaesCount > MAX_OBJECTS)
-            return;
+         uploadTimeline.wait(uploadValue);
+         releaseTexture(handle);
+      });
+}
 
-         UboModel* allignedLocation = reinterpret_cast<UboModel*>(reinterpret_cast<char*>(modelTransferSpace) + meshaesCount * modelUniformAlignment);
-         memcpy(allignedLocation, &uboModel, sizeof(UboModel));
+uint32_t VulkanRenderer::loadTexture(const char* imageFileName, UploadBatch& uploadBatch)
+{
+   std::string path = TextureRegistry::normalizePath(imageFileName);
+   uint32_t handle = textureRegistry.findByPath(path);
+   if (handle != TextureRegistry::INVALID_HANDLE)
+   {
+      textureRegistry.acquire(handle);
+      return handle;
+   }
 
-         ++meshaesCount;
+   DecodedTexture texture;
+   decodeTexture(path, &texture);
+   return addDecodedTexture(texture, true, uploadBatch);
+}
+
+uint32_t VulkanRenderer::addDecodedTexture(const DecodedTexture& texture, bool deduplicate, UploadBatch& uploadBatch)
+{
+   if (deduplicate)
+   {
+      uint32_t handle = textureRegistry.findByContent(texture.contentHash);
+      if (handle != TextureRegistry::INVALID_HANDLE)
+      {
+         textureRegistry.addAlias(handle, texture.fileName);
+         textureRegistry.acquire(handle);
+         return handle;
       }
    }
 
-   void* bufferMem = nullptr;
-   VkDeviceSize size = modelUniformAlignment * std::min(MAX_OBJECTS, meshes.size());
-   if (VK_SUCCESS != vkMapMemory(mainDevice.logicalDevice, dynamicUboBuffersMemory[frame], 0, size, 0, &bufferMem))
-      throw std::runtime_error("Unable to map dynamic object memory");
-   memcpy(bufferMem, modelTransferSpace, size);
-   vkUnmapMemory(mainDevice.logicalDevice, dynamicUboBuffersMemory[frame]);
+   uint32_t handle = textureRegistry.add(texture.fileName, texture.contentHash);
+   try
+   {
+      createTexture(texture, handle, uploadBatch);
+   }
+   catch (...)
+   {
+      textureRegistry.release(handle);
+      throw;
+   }
+   return handle;
 }
 
-void VulkanRenderer::allocateDynamicBufferTransferSpace()
+void VulkanRenderer::releaseTexture(uint32_t handle)
 {
-   modelUniformAlignment = (sizeof(UboModel) + mainDevice.minStorageBufferOffsetAlignment - 1) 
-      & ~(mainDevice.minStorageBufferOffsetAlignment - 1);
+   if (handle >= loadedTextures.size() || !textureRegistry.release(handle))
+      return;
 
-   modelTransferSpace = reinterpret_cast<UboModel*>(_aligned_malloc(MAX_OBJECTS * modelUniformAlignment, modelUniformAlignment));
+   destroyTexture(loadedTextures[handle]);
+   loadedTextures[handle] = LoadedImage();
 }
 
-uint32_t VulkanRenderer::loadTexture(const char* imageFileName)
+void VulkanRenderer::destroyTexture(LoadedImage& texture)
 {
-   for (uint32_t i = 0; i < loadedTextures.size(); ++i)
-      if (loadedTextures[i].fileName == imageFileName)
-         return i;
+   if (texture.image == VK_NULL_HANDLE)
+      return;
 
-   Image i = readImage(imageFileName, ReadImageChannels::rgb_alpha);
+   vkDestroyImageView(mainDevice.logicalDevice, texture.imageView, nullptr);
+   vkDestroyImage(mainDevice.logicalDevice, texture.image, nullptr);
+   memoryAllocator.free(texture.memory);
+   if (texture.samplerSet != VK_NULL_HANDLE)
+      vkFreeDescriptorSets(mainDevice.logicalDevice, texture.samplerPool, 1, &texture.samplerSet);
+}
 
-   if (i.data.empty())
+void VulkanRenderer::decodeTexture(const std::string& imageFileName, DecodedTexture* texture) const
+{
+   texture->fileName = imageFileName;
+
+   if (openCompressedTexture(imageFileName, &texture->compressed))
+   {
+      texture->format = texture->compressed.getFormat();
+      texture->width = texture->compressed.getWidth();
+      texture->height = texture->compressed.getHeight();
+      texture->mipLevels = texture->compressed.getLevelCount();
+
+      uint64_t hash = hashData(&texture->format, sizeof(texture->format));
+      hash = hashData(&texture->width, sizeof(texture->width), hash);
+      hash = hashData(&texture->height, sizeof(texture->height), hash);
+      for (const auto& level : texture->compressed.getLevels())
+         hash = hashData(texture->compressed.getData() + level.offset, level.size, hash);
+      texture->contentHash = hash;
+      return;
+   }
+
+   texture->image = readImage(imageFileName.c_str(), ReadImageChannels::rgb_alpha);
+
+   if (texture->image.data.empty())
       throw std::runtime_error("Could not load texture");
 
-   VkBuffer stagingBuffer = VK_NULL_HANDLE;
-   VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+   texture->format = VK_FORMAT_R8G8B8A8_UNORM;
+   texture->width = texture->image.width;
+   texture->height = texture->image.height;
+   texture->mipLevels = getMipLevelCount(texture->width, texture->height);
 
-   creteBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, i.data.size(),
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &stagingBuffer, &stagingMemory);
+   uint64_t hash = hashData(&texture->format, sizeof(texture->format));
+   hash = hashData(&texture->width, sizeof(texture->width), hash);
+   hash = hashData(&texture->height, sizeof(texture->height), hash);
+   texture->contentHash = hashData(texture->image.data.data(), texture->image.data.size(), hash);
 
-   void* data = nullptr;
-   if (VK_SUCCESS != vkMapMemory(mainDevice.logicalDevice, stagingMemory, 0, i.data.size(), 0, &data))
-      throw std::runtime_error("Unable to map staging buffer for image");
+   //the blits need linear filtering on the format, otherwise the levels are made here and uploaded with level 0
+   VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+   if (texture->mipLevels > 1 && !isImageFormatSupported(texture->format, VK_IMAGE_TILING_OPTIMAL, blitFeatures))
+      texture->mipChain = buildMipChain(texture->image, static_cast<uint32_t>(ReadImageChannels::rgb_alpha), texture->mipLevels, &texture->levelOffsets);
+}
 
-   memcpy(data, i.data.data(), i.data.size());
+void VulkanRenderer::createTexture(const DecodedTexture& texture, uint32_t handle, UploadBatch& uploadBatch)
+{
+   if (useBindlessTextures && handle >= bindlessTextureCapacity)
+      throw std::runtime_error("Too many textures for the bindless texture array");
 
-   vkUnmapMemory(mainDevice.logicalDevice, stagingMemory);
+   VkFormat imageFormat = texture.format;
+   uint32_t mipLevels = texture.mipLevels;
 
-   VkFormat imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+   LoadedImage li;
+   li.fileName = texture.fileName;
+   li.mipLevels = mipLevels;
 
-   VkDeviceMemory outMemory = VK_NULL_HANDLE;
-   VkImage out = createImage(i.width, i.height, 
-      imageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-      VkMemoryPropertyFlagBits::VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &outMemory);
+   //the parts made so far are destroyed when a later step throws, the caller releases the handle
+   try
+   {
+      if (!texture.image.data.empty())
+      {
+         li.image = createImage(texture.width, texture.height,
+            imageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VkMemoryPropertyFlagBits::VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &li.memory, mipLevels);
+
+         if (mipLevels == 1)
+            uploadBatch.uploadImage(li.image, texture.width, texture.height, texture.image.data.data(), texture.image.data.size());
+         else if (texture.mipChain.empty())
+            uploadBatch.uploadImageWithMipGeneration(li.image, texture.width, texture.height, mipLevels, texture.image.data.data(), texture.image.data.size());
+         else
+            uploadBatch.uploadImage(li.image, texture.width, texture.height, texture.mipChain.data(), texture.mipChain.size(), texture.levelOffsets);
+      }
+      else
+      {
+         li.image = createImage(texture.width, texture.height,
+            imageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VkMemoryPropertyFlagBits::VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &li.memory, mipLevels);
+
+         //the levels are copied straight from the mapped file, the smallest one is stored first
+         const std::vector<Ktx2Level>& levels = texture.compressed.getLevels();
+         uint64_t begin = UINT64_MAX;
+         uint64_t end = 0;
+         for (const auto& level : levels)
+         {
+            begin = std::min(begin, level.offset);
+            end = std::max(end, level.offset + level.size);
+         }
 
-   transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, out, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-   copyImage(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, out, stagingBuffer, i.width, i.height);
-   transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, out, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+         std::vector<VkDeviceSize> levelOffsets;
+         for (const auto& level : levels)
+            levelOffsets.push_back(level.offset - begin);
 
-   VkImageView outImageView = createImageView(mainDevice.logicalDevice, out, imageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+         uploadBatch.uploadImage(li.image, texture.width, texture.height, texture.compressed.getData() + begin, end - begin, levelOffsets);
+      }
 
-   vkFreeMemory(mainDevice.logicalDevice, stagingMemory, nullptr);
-   vkDestroyBuffer(mainDevice.logicalDevice, stagingBuffer, nullptr);
+      li.imageView = createImageView(mainDevice.logicalDevice, li.image, imageFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
 
-   VkDescriptorSet outSet = VK_NULL_HANDLE;
+      //bindless textures only write their element of the shared array
+      if (useBindlessTextures)
+      {
+         writeTextureDescriptor(bindlessTextureSet, handle, li.imageView);
+      }
+      else
+      {
+         li.samplerSet = allocateTextureSamplerSet(&li.samplerPool);
+         writeTextureDescriptor(li.samplerSet, 0, li.imageView);
+      }
+   }
+   catch (...)
    {
-      VkDescriptorSetAllocateInfo descriptorSetAllocationInfo = {};
-      descriptorSetAllocationInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-      descriptorSetAllocationInfo.descriptorPool = subPassASamplerDescriptorPool;
-      descriptorSetAllocationInfo.descriptorSetCount = 1;
-      descriptorSetAllocationInfo.pSetLayouts = &samplerDescriptorSetLayout;
+      destroyTexture(li);
+      throw;
+   }
+
+   if (loadedTextures.size() <= handle)
+      loadedTextures.resize(handle + 1);
+   loadedTextures[handle] = std::move(li);
+}
+
+bool VulkanRenderer::openCompressedTexture(const std::string& imageFileName, Ktx2Texture* texture) const
+{
+   if (!mainDevice.textureCompressionBC)
+      return false;
+
+   VkFormatFeatureFlags flags = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
 
-      if (VK_SUCCESS != vkAllocateDescriptorSets(mainDevice.logicalDevice, &descriptorSetAllocationInfo, &outSet))
-         throw std::runtime_error("Unable to allocate descriptors for samplers");
+   //cooked on the first load when enabled, only when both formats the cooker picks from can be sampled
+   std::string cookedPath = getCookedTexturePath(imageFileName);
+   if (!openCookedTexture(cookedPath, imageFileName, texture))
+   {
+      if (!cookTexturesOnLoad)
+         return false;
 
-      VkDescriptorImageInfo imageInfo = {};
-      imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-      imageInfo.imageView = outImageView;
-      imageInfo.sampler = textureSampler;
+      if (!isImageFormatSupported(VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_IMAGE_TILING_OPTIMAL, flags) ||
+         !isImageFormatSupported(VK_FORMAT_BC3_UNORM_BLOCK, VK_IMAGE_TILING_OPTIMAL, flags))
+         return false;
 
-      VkWriteDescriptorSet writeDescriptorSet = {};
-      writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-      writeDescriptorSet.descriptorCount = 1;
-      writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-      writeDescriptorSet.dstBinding = 0;
-      writeDescriptorSet.dstArrayElement = 0;
-      writeDescriptorSet.pImageInfo = &imageInfo;
-      writeDescriptorSet.dstSet = outSet;
-      vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
+      if (!cookTexture(imageFileName, cookedPath) || !openCookedTexture(cookedPath, imageFileName, texture))
+         return false;
    }
 
-   LoadedImage li{ imageFileName, out, outMemory, outImageView, outSet };
-   loadedTextures.emplace_back(std::move(li));
+   //files from other tools can hold any format, bc7 included
+   if (!isImageFormatSupported(texture->getFormat(), VK_IMAGE_TILING_OPTIMAL, flags))
+   {
+      texture->close();
+      return false;
+   }
 
-   return static_cast<uint32_t>(loadedTextures.size() - 1);
+   return true;
 }
 
 void VulkanRenderer::createTextureSampler()
@@ -1590,7 +2132,8 @@ void VulkanRenderer::createTextureSampler()
    createInfo.minFilter = VK_FILTER_LINEAR;
    createInfo.mipLodBias = 0.0f;
    createInfo.minLod = 0;
-   createInfo.maxLod = 0;
+   //shared by all the textures, the views limit it to the levels each one has
+   createInfo.maxLod = VK_LOD_CLAMP_NONE;
    createInfo.anisotropyEnable = VK_FALSE;
    createInfo.compareEnable = VK_FALSE;
    createInfo.unnormalizedCoordinates = VK_FALSE;
@@ -1599,13 +2142,18 @@ void VulkanRenderer::createTextureSampler()
       throw std::runtime_error("Unable to create texture sampler");
 }
 
-void VulkanRenderer::recordCommandBuffers(size_t frame)
+void VulkanRenderer::recordCommandBuffers(size_t frame, uint32_t imageIndex)
 {
+   //the caller made sure the last submit of this frame is done, the pool only holds its primary buffer
+   size_t slot = getRecordingSlot(frame, imageIndex);
+   if (VK_SUCCESS != vkResetCommandPool(mainDevice.logicalDevice, frameCommandPools[slot], 0))
+      throw std::runtime_error("Unable to reset the frame command pool");
+
    VkCommandBufferBeginInfo beginInfo = {};
    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
 
-   if (VK_SUCCESS != vkBeginCommandBuffer(commandBuffers[frame], &beginInfo))
+   if (VK_SUCCESS != vkBeginCommandBuffer(commandBuffers[slot], &beginInfo))
       throw std::runtime_error("Unable to begin recording command buffer");
 
    VkRenderPassBeginInfo beginRenderPassInfo = {};
@@ -1620,66 +2168,179 @@ void VulkanRenderer::recordCommandBuffers(size_t frame)
    };
    beginRenderPassInfo.pClearValues = clearValues;
    beginRenderPassInfo.clearValueCount = 3;
-   beginRenderPassInfo.framebuffer = swapChainFramebuffers[frame];
+   beginRenderPassInfo.framebuffer = swapChainFramebuffers[slot];
+
+   //the draws of subpass A in a flat list so they can be split between the recording threads
+   meshDraws.clear();
+   uint32_t firstInstance = 0;
+   for (auto& model : meshes)
+   {
+      uint32_t instanceCount = model.getInstanceCount();
+      if (instanceCount == 0)
+         continue;
 
+      for (uint32_t m = 0; m < model.getMeshCount(); ++m)
+      {
+         MeshDraw draw;
+         draw.mesh = model.getMesh(m);
+         draw.instanceCount = instanceCount;
+         draw.firstInstance = firstInstance;
+         meshDraws.push_back(draw);
+      }
+
+      firstInstance += instanceCount;
+   }
 
-   vkCmdBeginRenderPass(commandBuffers[frame], &beginRenderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+   //no empty chunks, a few draws are not worth a thread each
+   size_t chunkCount = std::min<size_t>(recordingThreadCount, meshDraws.size());
+   size_t drawsPerChunk = chunkCount == 0 ? meshDraws.size() : (meshDraws.size() + chunkCount - 1) / chunkCount;
+   if (chunkCount > 0)
+      chunkCount = (meshDraws.size() + drawsPerChunk - 1) / drawsPerChunk;
+
+   recordingTimes.assign(std::max<size_t>(chunkCount, 1), 0.0);
 
    //render subpass A
-   vkCmdBindPipeline(commandBuffers[frame], VK_PIPELINE_BIND_POINT_GRAPHICS, subPassAGraphicsPipeline);
+   if (chunkCount == 0)
+   {
+      vkCmdBeginRenderPass(commandBuffers[slot], &beginRenderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-   uint32_t meshIndex = 0;
-   for (auto& model: meshes)
+      auto recordingStart = std::chrono::steady_clock::now();
+      recordSubPassADraws(commandBuffers[slot], frame, meshDraws.data(), meshDraws.size());
+      recordingTimes[0] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordingStart).count();
+   }
+   else
    {
-      vkCmdPushConstants(commandBuffers[frame], subPassAPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushModel), &model.getPushData());
+      VkCommandBuffer* chunkCommandBuffers = &secondaryCommandBuffers[slot * recordingThreadCount];
 
-      for (uint32_t m = 0; m < model.getMeshCount(); ++m) {
-         VkDescriptorSet descriptors[] = { subPassABufferDescriptorSets[frame], loadedTextures[model.getMesh(m)->getTextureId()].samplerSet };
+      //every chunk has its own pool, so the threads never share one
+      threadPool.parallelFor(chunkCount, [&](size_t chunk)
+      {
+         auto recordingStart = std::chrono::steady_clock::now();
 
-         uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * meshIndex++;
-         vkCmdBindDescriptorSets(commandBuffers[frame], VK_PIPELINE_BIND_POINT_GRAPHICS, subPassAPipelineLayout, 0, 2, descriptors, 1, &dynamicOffset);
+         if (VK_SUCCESS != vkResetCommandPool(mainDevice.logicalDevice, recordingPools[slot * recordingThreadCount + chunk], 0))
+            throw std::runtime_error("Unable to reset the recording command pool");
 
-         VkDeviceSize offsets[] = { 0 };
-         VkBuffer buffers[] = { model.getMesh(m)->getVertexBuffer() };
-         vkCmdBindVertexBuffers(commandBuffers[frame], 0, 1, buffers, offsets);
+         VkCommandBufferInheritanceInfo inheritanceInfo = {};
+         inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+         inheritanceInfo.renderPass = renderPass;
+         inheritanceInfo.subpass = 0;
+         inheritanceInfo.framebuffer = swapChainFramebuffers[slot];
 
-         vkCmdBindIndexBuffer(commandBuffers[frame], model.getMesh(m)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT16);
+         VkCommandBufferBeginInfo secondaryBeginInfo = {};
+         secondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+         secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+         secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
 
-         vkCmdDrawIndexed(commandBuffers[frame], model.getMesh(m)->getIndicesCount(), 1, 0, 0, 0);
-      }
+         if (VK_SUCCESS != vkBeginCommandBuffer(chunkCommandBuffers[chunk], &secondaryBeginInfo))
+            throw std::runtime_error("Unable to begin recording secondary command buffer");
+
+         size_t firstDraw = chunk * drawsPerChunk;
+         recordSubPassADraws(chunkCommandBuffers[chunk], frame, meshDraws.data() + firstDraw, std::min(drawsPerChunk, meshDraws.size() - firstDraw));
+
+         if (VK_SUCCESS != vkEndCommandBuffer(chunkCommandBuffers[chunk]))
+            throw std::runtime_error("Unable to end recording secondary command buffer");
+
+         recordingTimes[chunk] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordingStart).count();
+      });
+
+      vkCmdBeginRenderPass(commandBuffers[slot], &beginRenderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+      vkCmdExecuteCommands(commandBuffers[slot], static_cast<uint32_t>(chunkCount), chunkCommandBuffers);
    }
 
-   //render subpass B
-   vkCmdNextSubpass(commandBuffers[frame], VK_SUBPASS_CONTENTS_INLINE);
+   //render subpass B, the dynamic state of the primary buffer is lost after executing secondary buffers
+   vkCmdNextSubpass(commandBuffers[slot], VK_SUBPASS_CONTENTS_INLINE);
+   setViewportAndScissor(commandBuffers[slot]);
 
-   vkCmdBindPipeline(commandBuffers[frame], VK_PIPELINE_BIND_POINT_GRAPHICS, subPassBGraphicsPipeline);
-   vkCmdBindDescriptorSets(commandBuffers[frame], VK_PIPELINE_BIND_POINT_GRAPHICS, subPassBPipelineLayout, 0, 1, &subPassBInputDescriptorSets[frame], 0, nullptr);
+   vkCmdBindPipeline(commandBuffers[slot], VK_PIPELINE_BIND_POINT_GRAPHICS, subPassBGraphicsPipeline);
+   vkCmdBindDescriptorSets(commandBuffers[slot], VK_PIPELINE_BIND_POINT_GRAPHICS, subPassBPipelineLayout, 0, 1, &subPassBInputDescriptorSets[frame], 0, nullptr);
 
    float screenWidth = static_cast<float>(currentResolution.width);
-   vkCmdPushConstants(commandBuffers[frame], subPassBPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &screenWidth);
+   vkCmdPushConstants(commandBuffers[slot], subPassBPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(float), &screenWidth);
 
-   vkCmdDraw(commandBuffers[frame], 6, 1, 0, 0);
+   vkCmdDraw(commandBuffers[slot], 6, 1, 0, 0);
 
-   vkCmdEndRenderPass(commandBuffers[frame]);
+   vkCmdEndRenderPass(commandBuffers[slot]);
 
-   if (VK_SUCCESS != vkEndCommandBuffer(commandBuffers[frame]))
+   if (VK_SUCCESS != vkEndCommandBuffer(commandBuffers[slot]))
       throw std::runtime_error("Unable to end recording command buffer");
 
+   recordedVersions[slot] = recordingsVersion;
+
 }
 
-VkShaderModule VulkanRenderer::createShaderModule(VkDevice device, const std::vector<char>& code) const
+void VulkanRenderer::recordSubPassADraws(VkCommandBuffer commandBuffer, size_t frame, const MeshDraw* draws, size_t drawCount) const
 {
-   VkShaderModuleCreateInfo createInfo = {};
-   createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-   createInfo.codeSize = code.size();
-   createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-   
-   VkShaderModule out = VK_NULL_HANDLE;
+   //a secondary buffer inherits no state, so every chunk sets all of it
+   setViewportAndScissor(commandBuffer);
 
-   if (VK_SUCCESS != vkCreateShaderModule(device, &createInfo, nullptr, &out))
-      throw std::runtime_error("Unable to create shader module");
+   vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, subPassAGraphicsPipeline);
 
-   return out;
+   //the partitions written by updateUniformBuffers, the objects are indexed in the shader by firstInstance
+   uint32_t dynamicOffsets[] = {
+      static_cast<uint32_t>(uniformRing.getFrameOffset(static_cast<uint32_t>(frame))),
+      static_cast<uint32_t>(objectRing->getFrameOffset(static_cast<uint32_t>(frame)))
+   };
+   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, subPassAPipelineLayout, 0, 1, &subPassABufferDescriptorSet, 2, dynamicOffsets);
+
+   //the bindless array is bound once, the meshes only push the index of their texture
+   if (useBindlessTextures)
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, subPassAPipelineLayout, 1, 1, &bindlessTextureSet, 0, nullptr);
+
+   //all the meshes share the geometry pool buffers, they are bound again only when a mesh lives in another page
+   uint32_t boundGeometryPage = UINT32_MAX;
+   VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+   for (size_t i = 0; i < drawCount; ++i)
+   {
+      const Mesh* mesh = draws[i].mesh;
+      if (useBindlessTextures)
+      {
+         uint32_t textureIndex = static_cast<uint32_t>(mesh->getTextureId());
+         vkCmdPushConstants(commandBuffer, subPassAPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(PushMeshBounds), sizeof(uint32_t), &textureIndex);
+      }
+      else
+      {
+         vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, subPassAPipelineLayout, 1, 1, &loadedTextures[mesh->getTextureId()].samplerSet, 0, nullptr);
+      }
+
+      if (mesh->getGeometryPage() != boundGeometryPage)
+      {
+         boundGeometryPage = mesh->getGeometryPage();
+         boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+         VkDeviceSize offsets[] = { 0 };
+         VkBuffer buffers[] = { mesh->getVertexBuffer() };
+         vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+      }
+
+      //a page holds both index types, firstIndex is in units of the type the mesh was stored with
+      if (mesh->getIndexType() != boundIndexType)
+      {
+         boundIndexType = mesh->getIndexType();
+         vkCmdBindIndexBuffer(commandBuffer, mesh->getIndexBuffer(), 0, boundIndexType);
+      }
+
+      vkCmdPushConstants(commandBuffer, subPassAPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushMeshBounds), &mesh->getBounds());
+
+      vkCmdDrawIndexed(commandBuffer, mesh->getIndicesCount(), draws[i].instanceCount, mesh->getFirstIndex(), mesh->getVertexOffset(), draws[i].firstInstance);
+   }
+}
+
+void VulkanRenderer::setViewportAndScissor(VkCommandBuffer commandBuffer) const
+{
+   //both pipelines take them as dynamic state
+   VkViewport viewport = {};
+   viewport.x = 0;
+   viewport.y = 0;
+   viewport.width = static_cast<float>(currentResolution.width);
+   viewport.height = static_cast<float>(currentResolution.height);
+   viewport.minDepth = 0.0f;
+   viewport.maxDepth = 1.0f;
+   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+   VkRect2D scissor = {};
+   scissor.offset = { 0, 0 };
+   scissor.extent = currentResolution;
+   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 }
 
 VkExtent2D VulkanRenderer::selectBestResolution(GLFWwindow* window, VkSurfaceCapabilitiesKHR surfaceCapabilityes) const
@@ -1709,7 +2370,7 @@ VkExtent2D VulkanRenderer::selectBestResolution(GLFWwindow* window, VkSurfaceCap
    return { widthV ,  heightV };
 }
 
-VkImageView VulkanRenderer::createImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) const
+VkImageView VulkanRenderer::createImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) const
 {
    VkImageViewCreateInfo createInfo = {};
    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1723,7 +2384,7 @@ VkImageView VulkanRenderer::createImageView(VkDevice device, VkImage image, VkFo
 
    createInfo.subresourceRange.aspectMask = aspectFlags;
    createInfo.subresourceRange.baseMipLevel = 0;
-   createInfo.subresourceRange.levelCount = 1;
+   createInfo.subresourceRange.levelCount = mipLevels;
    createInfo.subresourceRange.baseArrayLayer = 0;
    createInfo.subresourceRange.layerCount = 1;
 
@@ -1868,6 +2529,7 @@ void VulkanRenderer::getPhysicalDevice()
       throw std::runtime_error("Unable to find a sutable physical device");
 
    mainDevice.minStorageBufferOffsetAlignment = score.minStorageBufferOffsetAlignment;
+   mainDevice.minUniformBufferOffsetAlignment = score.minUniformBufferOffsetAlignment;
    mainDevice.physicalDevice = selectedDevice;
 }
 
@@ -1879,6 +2541,7 @@ DeviceScore VulkanRenderer::checkDeviceSutable(VkPhysicalDevice device) const
    vkGetPhysicalDeviceProperties(device, &properties);
 
    score.minStorageBufferOffsetAlignment = properties.limits.minStorageBufferOffsetAlignment;
+   score.minUniformBufferOffsetAlignment = properties.limits.minUniformBufferOffsetAlignment;
 
    if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
       ++score.deviceScore;
@@ -1889,7 +2552,8 @@ DeviceScore VulkanRenderer::checkDeviceSutable(VkPhysicalDevice device) const
 
    QueueFamilyIndices queues = getQueueFamilyIndices(device);
 
-   if (!queues.valid() || !checkDeviceSwapChainSupport(device))
+   //the frames and the uploads are synchronized with timeline semaphores
+   if (!queues.valid() || !checkDeviceSwapChainSupport(device) || !checkDeviceExtensionSupport(device, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
       return {};
 
    SwapchainDetails swapchainDetails = getSwapchainDetails(device, surface);
@@ -1905,11 +2569,14 @@ bool QueueFamilyIndices::valid()
    return graphicFamily >= 0 && presentationFamily >= 0;
 }
 
-static Mesh loadMesh(VkPhysicalDevice phisicalDevice, VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-   aiMesh* mesh, const aiScene& scene, const std::vector<uint32_t>& materialToTexture)
+static void loadMesh(VertexFormat vertexFormat, aiMesh* mesh, const ModelLoadOptions& options, std::vector<CookedMesh>& out)
 {
    std::vector<Vertex> vertices(mesh->mNumVertices);
-   std::vector<uint16_t> indices;
+
+   size_t indexCount = 0;
+   for (size_t i = 0; i < mesh->mNumFaces; ++i)
+      indexCount += mesh->mFaces[i].mNumIndices;
+   std::vector<uint32_t> indices(indexCount);
 
    aiVector3D* textureCoordonateChannel = nullptr;
    if (mesh->HasTextureCoords(0))
@@ -1935,49 +2602,77 @@ static Mesh loadMesh(VkPhysicalDevice phisicalDevice, VkDevice logicalDevice, Vk
       vertices[i] = std::move(out);
    }
 
+   uint32_t* index = indices.data();
    for (size_t i = 0; i < mesh->mNumFaces; ++i)
    {
       aiFace* face = mesh->mFaces + i;
       for (size_t j = 0; j < face->mNumIndices; ++j)
       {
-         indices.push_back(face->mIndices[j]);
+         *index++ = face->mIndices[j];
       }
    }
 
-   return Mesh(phisicalDevice, logicalDevice, transferQueue, transferCommandPool, vertices, indices, materialToTexture[mesh->mMaterialIndex]);
-   
-}
+   //point and line faces survive aiProcess_Triangulate, the reordering only works on triangle lists
+   if (options.optimizeMeshes && indices.size() == mesh->mNumFaces * 3)
+   {
+      VertexCacheStatistics before = analyzeVertexCache(indices, vertices.size());
 
-static std::vector<Mesh> loadNode(VkPhysicalDevice phisicalDevice, VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-   aiNode* node, const aiScene& scene, const std::vector<uint32_t>& materialToTexture)
-{
-   std::vector<Mesh> out;
-   for (unsigned int i = 0; i < node->mNumMeshes; ++i)
+      optimizeVertexCache(indices, vertices.size());
+      optimizeOverdraw(indices, vertices);
+      optimizeVertexFetch(vertices, indices);
+
+      if (options.printMeshStatistics)
+      {
+         VertexCacheStatistics after = analyzeVertexCache(indices, vertices.size());
+         printf("mesh %s : %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", mesh->mName.C_Str(), mesh->mNumFaces,
+            before.acmr, after.acmr, before.atvr, after.atvr);
+      }
+   }
+
+   if (options.splitLargeMeshes && vertices.size() > Mesh::MAX_SHORT_INDEX_VERTICES)
    {
-      out.emplace_back(loadMesh(phisicalDevice, logicalDevice, transferQueue, transferCommandPool, scene.mMeshes[node->mMeshes[i]], scene, materialToTexture));
+      for (const auto& chunk : splitForShortIndices(vertices, indices))
+         out.emplace_back(cookMesh(chunk.vertices, chunk.indices, vertexFormat, mesh->mMaterialIndex));
    }
+   else
+   {
+      out.emplace_back(cookMesh(vertices, indices, vertexFormat, mesh->mMaterialIndex));
+   }
+}
 
-   for (unsigned int i = 0; i < node->mNumChildren; ++i)
+//the meshes of the node tree in depth first order, a mesh referenced by several nodes is listed for each of them
+static std::vector<aiMesh*> loadNode(aiNode* root, const aiScene& scene)
+{
+   std::vector<aiMesh*> out;
+   std::vector<aiNode*> nodes = { root };
+   while (!nodes.empty())
    {
-      std::vector<Mesh> childMeshes = loadNode(phisicalDevice, logicalDevice, transferQueue, transferCommandPool, node->mChildren[i], scene, materialToTexture);
-      for (auto& m : childMeshes)
+      aiNode* node = nodes.back();
+      nodes.pop_back();
+
+      for (unsigned int i = 0; i < node->mNumMeshes; ++i)
       {
-         out.emplace_back(std::move(m));
+         out.push_back(scene.mMeshes[node->mMeshes[i]]);
+      }
+
+      for (unsigned int i = node->mNumChildren; i > 0; --i)
+      {
+         nodes.push_back(node->mChildren[i - 1]);
       }
    }
 
-   return std::move(out);
+   return out;
 }
 
-uint32_t VulkanRenderer::loadModel(const std::string& fileName)
+static void importModel(ThreadPool& threadPool, const std::string& fileName, VertexFormat vertexFormat, const ModelLoadOptions& options,
+   std::vector<std::string>* textureNames, std::vector<CookedMesh>* cookedMeshes)
 {
    Assimp::Importer importer;
    const aiScene* scene = importer.ReadFile(fileName, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
    if (!scene)
       throw std::runtime_error("Failed to load model :" + fileName);
 
-
-   std::vector<std::string> textureNames(scene->mNumMaterials);
+   textureNames->resize(scene->mNumMaterials);
    for (size_t i = 0; i < scene->mNumMaterials; ++i)
    {
       aiMaterial* material = scene->mMaterials[i];
@@ -1996,45 +2691,230 @@ uint32_t VulkanRenderer::loadModel(const std::string& fileName)
       size_t lastBackslash = texturePath.rfind('\\');
       if (lastBackslash != std::string::npos)
       {
-         textureNames[i] = texturePath.substr(lastBackslash + 1);
+         (*textureNames)[i] = texturePath.substr(lastBackslash + 1);
       }
       else
       {
-         textureNames[i] = std::move(texturePath);
+         (*textureNames)[i] = std::move(texturePath);
       }
    }
 
-   std::vector<uint32_t> mapMaterialToLoadedTexture(textureNames.size());
+   //the scene is only read while the meshes are converted, every mesh writes its own slot
+   std::vector<aiMesh*> sceneMeshes = loadNode(scene->mRootNode, *scene);
+   std::vector<std::vector<CookedMesh>> convertedMeshes(sceneMeshes.size());
+   threadPool.parallelFor(sceneMeshes.size(), [&](size_t i)
+   {
+      loadMesh(vertexFormat, sceneMeshes[i], options, convertedMeshes[i]);
+   });
+
+   size_t cookedMeshCount = 0;
+   for (const auto& m : convertedMeshes)
+      cookedMeshCount += m.size();
+
+   cookedMeshes->reserve(cookedMeshCount);
+   for (auto& m : convertedMeshes)
+      for (auto& c : m)
+         cookedMeshes->emplace_back(std::move(c));
+}
 
-   size_t index = 0;
-   for (const auto& i : textureNames)
+uint32_t VulkanRenderer::loadModel(const std::string& fileName, const ModelLoadOptions& options)
+{
+   //everything that changes the cooked data is part of the settings, a cache cooked with other settings is imported again
+   uint32_t cacheSettings = static_cast<uint32_t>(vertexFormat) | (options.optimizeMeshes ? 0x100 : 0) | (options.splitLargeMeshes ? 0x200 : 0);
+   std::string cachePath = fileName + ".meshcache";
+
+   MeshCache meshCache;
+   std::vector<std::string> textureNames;
+   std::vector<CookedMesh> importedMeshes;
+   std::vector<CookedMeshView> cookedMeshes;
+
+   if (options.useMeshCache && meshCache.open(cachePath, fileName, cacheSettings))
    {
-      if (i.empty())
-         mapMaterialToLoadedTexture[index++] = 0; // use the empty texture
-      else
-         mapMaterialToLoadedTexture[index++] = loadTexture(i.c_str());
+      textureNames = meshCache.getMaterialTextures();
+      cookedMeshes = meshCache.getMeshes();
    }
+   else
+   {
+      importModel(threadPool, fileName, vertexFormat, options, &textureNames, &importedMeshes);
+
+      if (options.useMeshCache)
+         MeshCache::write(cachePath, fileName, cacheSettings, textureNames, importedMeshes);
 
-   std::vector<Mesh> modelMeshes = loadNode(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, scene->mRootNode, *scene, mapMaterialToLoadedTexture);
-   meshes.emplace_back(std::move(modelMeshes));
+      for (const auto& m : importedMeshes)
+         cookedMeshes.push_back(m.view());
+   }
+
+   //the textures and all the meshes of the model go to the gpu in a single submission, the mapped cache is only read while recording the copies
+   UploadBatch uploadBatch(&memoryAllocator, mainDevice.logicalDevice, uploadQueues);
+
+   //the model holds one reference for every texture it uses, the same file reached with another path is found by the normalized one
+   for (auto& i : textureNames)
+      i = TextureRegistry::normalizePath(i);
+
+   std::vector<uint32_t> textureHandles;
+   std::vector<Mesh> modelMeshes;
+   try
+   {
+      auto acquireOnce = [this, &textureHandles](uint32_t handle)
+      {
+         if (std::find(textureHandles.begin(), textureHandles.end(), handle) != textureHandles.end())
+            return;
+
+         textureRegistry.acquire(handle);
+         textureHandles.push_back(handle);
+      };
+
+      std::vector<std::string> newTextureNames;
+      for (const auto& i : textureNames)
+      {
+         if (i.empty())
+         {
+            acquireOnce(defaultTextureHandle);
+            continue;
+         }
+
+         if (std::find(newTextureNames.begin(), newTextureNames.end(), i) != newTextureNames.end())
+            continue;
+
+         uint32_t handle = textureRegistry.findByPath(i);
+         if (handle == TextureRegistry::INVALID_HANDLE)
+            newTextureNames.push_back(i);
+         else
+            acquireOnce(handle);
+      }
+
+      //the new textures are decoded on the pool, then added in the order of the materials so the handles do not depend on the decode timing
+
+      std::vector<std::unique_ptr<DecodedTexture>> decodedTextures(newTextureNames.size());
+      threadPool.parallelFor(newTextureNames.size(), [this, &newTextureNames, &decodedTextures](size_t i)
+         {
+            decodedTextures[i].reset(new DecodedTexture());
+            decodeTexture(newTextureNames[i], decodedTextures[i].get());
+         });
+
+      for (const auto& i : decodedTextures)
+         textureHandles.push_back(addDecodedTexture(*i, options.deduplicateTextures, uploadBatch));
+      decodedTextures.clear();
+
+      std::vector<uint32_t> mapMaterialToLoadedTexture(textureNames.size());
+
+      size_t index = 0;
+      for (const auto& i : textureNames)
+      {
+         if (i.empty())
+            mapMaterialToLoadedTexture[index++] = defaultTextureHandle;
+         else
+            mapMaterialToLoadedTexture[index++] = textureRegistry.findByPath(i);
+      }
+
+      //the uint16 meshes first, so the index buffer is bound again at most once per index type
+      modelMeshes.reserve(cookedMeshes.size());
+      for (size_t indexSize : { sizeof(uint16_t), sizeof(uint32_t) })
+         for (const auto& m : cookedMeshes)
+            if (m.indexSize == indexSize)
+               modelMeshes.emplace_back(&geometryPool, uploadBatch, m, mapMaterialToLoadedTexture[m.materialIndex]);
+   }
+   catch (...)
+   {
+      //nothing was submitted, the references taken so far and the textures created for the model are dropped right away
+      modelMeshes.clear();
+      for (auto handle : textureHandles)
+         releaseTexture(handle);
+      throw;
+   }
+
+   meshes.emplace_back(std::move(modelMeshes), std::move(textureHandles));
+
+   pendingUploads.emplace_back(uploadBatch.submit());
+
+   reserveObjectCapacity(getObjectCount());
+   invalidateRecordings();
 
    return static_cast<uint32_t>(meshes.size() - 1);
 }
 
+void VulkanRenderer::unloadModel(size_t index)
+{
+   if (meshes.size() <= index)
+      return;
+
+   //the frames submitted so far may still draw from its ranges and textures, they are returned once they are done
+   //the uploads of a model that was never drawn can be later than those frames, they are waited for too
+   std::shared_ptr<MeshModel> unloaded = std::make_shared<MeshModel>(std::move(meshes[index]));
+   meshes[index].clean();
+
+   uint64_t uploadValue = uploadTimeline.getLastSubmitted();
+   deletionQueue.push(frameTimeline.getLastSubmitted(), [this, unloaded, uploadValue]()
+      {
+         uploadTimeline.wait(uploadValue);
+         for (auto handle : unloaded->getTextureHandles())
+            releaseTexture(handle);
+
+         unloaded->clean();
+      });
+
+   invalidateRecordings();
+}
+
+void VulkanRenderer::setModelTexture(size_t modelIndex, uint32_t meshIndex, uint32_t textureHandle)
+{
+   if (meshes.size() <= modelIndex || textureRegistry.getReferenceCount(textureHandle) == 0)
+      throw std::runtime_error("Invalid model or texture");
+
+   if (meshes[modelIndex].getMesh(meshIndex) == nullptr || meshes[modelIndex].getMesh(meshIndex)->getTextureId() == textureHandle)
+      return;
+
+   textureRegistry.acquire(textureHandle);
+   std::vector<uint32_t> releasedHandles;
+   meshes[modelIndex].setMeshTexture(meshIndex, textureHandle, &releasedHandles);
+
+   //the frames submitted so far may still sample the old texture
+   for (auto handle : releasedHandles)
+      deletionQueue.push(frameTimeline.getLastSubmitted(), [this, handle]()
+         {
+            releaseTexture(handle);
+         });
+
+   invalidateRecordings();
+}
+
+void VulkanRenderer::retireUploads()
+{
+   //uploads are submitted on the graphics queue before the frames that use them, only the staging memory waits for their value on the upload timeline
+   pendingUploads.erase(std::remove_if(pendingUploads.begin(), pendingUploads.end(),
+      [](UploadTicket& ticket)
+      {
+         if (!ticket.ready())
+            return false;
+
+         ticket.wait();
+         return true;
+      }), pendingUploads.end());
+}
+
+void VulkanRenderer::invalidateRecordings()
+{
+   ++recordingsVersion;
+
+   //fixed recordings are redone right away, the others by the next draw of each image
+   if (useFixedCommandBufferRecordings && !commandBuffers.empty())
+      updateRenderCommands();
+}
+
 void VulkanRenderer::updateRenderCommands()
 {
-   for (size_t i = 0; i < swapChainImages.size(); ++i)
+   //every pool is reset, so no frame may still be drawing
+   frameTimeline.wait(frameTimeline.getLastSubmitted());
+
+   for (size_t frame = 0; frame < framesInFlight; ++frame)
    {
-      recordCommandBuffers(i);
+      for (uint32_t i = 0; i < swapChainImages.size(); ++i)
+         recordCommandBuffers(frame, i);
    }
 }
 
-void ImageBuffer::clean(VkDevice logicalDevice)
+void ImageBuffer::clean(VkDevice logicalDevice, DeviceMemoryAllocator& allocator)
 {
-   if (deviceMemory != VK_NULL_HANDLE)
-      vkFreeMemory(logicalDevice, deviceMemory, nullptr);
-   deviceMemory = VK_NULL_HANDLE;
-
    if (imageView != VK_NULL_HANDLE)
       vkDestroyImageView(logicalDevice, imageView, nullptr);
    imageView = VK_NULL_HANDLE;
@@ -2042,4 +2922,6 @@ void ImageBuffer::clean(VkDevice logicalDevice)
    if (image != VK_NULL_HANDLE)
       vkDestroyImage(logicalDevice, image, nullptr);
    image = VK_NULL_HANDLE;
+
+   allocator.free(deviceMemory);
 }
@@ -2,6 +2,7 @@
 
 #include <stdexcept>
 #include <vector>
+#include <memory>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -12,15 +13,36 @@
 #include <gtc/matrix_transform.hpp>
 
 #include "mesh.h"
+#include "allocator.h"
+#include "upload.h"
+#include "ringbuffer.h"
+#include "geometrypool.h"
+#include "threadpool.h"
+#include "ktx2.h"
+#include "textureregistry.h"
+#include "pipelinecache.h"
+#include "shaderlibrary.h"
+#include "timeline.h"
 
-const size_t MAX_NUMBER_OF_PROCCESSED_FRAMES_INFLIGHT = 2;
-const size_t MAX_OBJECTS = 10;
-const size_t MAX_TEXTURES = 10;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4; //upper bound of setFramesInFlight
+const size_t INITIAL_OBJECT_CAPACITY = 1024; //the object storage buffer grows past this on demand
+const uint32_t TEXTURES_PER_SAMPLER_POOL = 64; //per texture sets without bindless textures, another pool is added when all of them are taken
+const uint32_t MAX_BINDLESS_TEXTURES = 4096; //upper bound of the bindless array, the device limits can lower it
+
+struct ModelLoadOptions
+{
+   bool splitLargeMeshes = false; //the meshes that need uint32 indices are split in chunks that can use uint16 ones
+   bool optimizeMeshes = true; //vertex cache, overdraw and vertex fetch order of the triangles
+   bool printMeshStatistics = false; //ACMR and ATVR of every mesh before and after the optimization
+   bool useMeshCache = true; //loads the cooked <model>.meshcache when it is up to date, writes it after an import otherwise
+   bool deduplicateTextures = true; //textures with the same decoded contents as a loaded one share its image, whatever their path
+};
 
 struct QueueFamilyIndices
 {
-   int32_t graphicFamily = -1; //by the standard this is also a transfer queue, but this can be optimized
+   int32_t graphicFamily = -1;
    int32_t presentationFamily = -1;
+   int32_t transferFamily = -1; //a transfer only family when the device has one, otherwise the graphics family
 
    bool valid();
 };
@@ -42,24 +64,50 @@ struct ImageBuffer
 {
    VkImage image = VK_NULL_HANDLE;
    VkImageView imageView = VK_NULL_HANDLE;
-   VkDeviceMemory deviceMemory = VK_NULL_HANDLE;
+   MemoryAllocation deviceMemory;
 
-   void clean(VkDevice logicalDevice);
+   void clean(VkDevice logicalDevice, DeviceMemoryAllocator& allocator);
 };
 
 struct DeviceScore
 {
    uint32_t deviceScore = 0;
    VkDeviceSize minStorageBufferOffsetAlignment = 0;
+   VkDeviceSize minUniformBufferOffsetAlignment = 0;
 };
 
 struct LoadedImage
 {
    std::string fileName;
    VkImage image = VK_NULL_HANDLE;
-   VkDeviceMemory memory = VK_NULL_HANDLE;
+   MemoryAllocation memory;
    VkImageView imageView = VK_NULL_HANDLE;
    VkDescriptorSet samplerSet = VK_NULL_HANDLE;
+   VkDescriptorPool samplerPool = VK_NULL_HANDLE; //the one samplerSet was allocated from
+   uint32_t mipLevels = 1;
+};
+
+//the cpu side of a texture, made on any thread before the image is created
+struct DecodedTexture
+{
+   std::string fileName;
+   uint64_t contentHash = 0; //of the data that is uploaded, with the format and size
+   VkFormat format = VK_FORMAT_UNDEFINED;
+   uint32_t width = 0;
+   uint32_t height = 0;
+   uint32_t mipLevels = 1;
+   Ktx2Texture compressed; //open when the texture is block compressed
+   Image image; //level 0 otherwise
+   std::vector<char> mipChain; //all the levels, only when the format can not be blitted
+   std::vector<VkDeviceSize> levelOffsets;
+};
+
+//one mesh of a model with all its instances, subpass A is recorded from a list of these
+struct MeshDraw
+{
+   const Mesh* mesh = nullptr;
+   uint32_t instanceCount = 0;
+   uint32_t firstInstance = 0;
 };
 
 class VulkanRenderer
@@ -71,16 +119,40 @@ public:
    VulkanRenderer& operator=(const VulkanRenderer&) = delete;
    VulkanRenderer& operator=(VulkanRenderer&&) = delete;
 
-   int init(GLFWwindow* window, bool useFixedCommandBufferRecordings);
+   //a command buffer is only recorded again after a change to what it draws, useFixedCommandBufferRecordings does that for all of them at the change instead of in draw
+   //VertexFormat::packed halves the vertex memory, positions are quantized to 16 bits inside the bounds of each mesh
+   //useBindlessTextures puts all the textures in one descriptor array when the device has VK_EXT_descriptor_indexing, one set per texture otherwise
+   int init(GLFWwindow* window, bool useFixedCommandBufferRecordings, VertexFormat vertexFormat = VertexFormat::full, bool useBindlessTextures = true);
    void cleanup();
 
    void draw();
 
+   //the handle holds a reference, unloadTexture releases it
    uint32_t loadTexture(const char* imageFileName);
-   uint32_t loadModel(const std::string& fileName);
+   void unloadTexture(uint32_t handle);
+   uint32_t loadModel(const std::string& fileName, const ModelLoadOptions& options = ModelLoadOptions());
+   //frees the geometry of the model, the index stays reserved so the other model indices do not change
+   void unloadModel(size_t index);
+   //the mesh draws with another loaded texture, the model holds a reference to it
+   void setModelTexture(size_t modelIndex, uint32_t meshIndex, uint32_t textureHandle);
+   //records every frame and swapchain image pair now instead of in the next draw that uses it
    void updateRenderCommands();
+   //0 records subpass A inline on the calling thread, otherwise its draws are split in up to threadCount secondary command buffers recorded on the thread pool
+   void setRecordingThreadCount(uint32_t threadCount);
+   //milliseconds spent recording each chunk of the last recorded frame, one entry when recording inline
+   const std::vector<double>& getRecordingTimes() const;
+   //1 to MAX_FRAMES_IN_FLIGHT frames the cpu can prepare ahead of the gpu, more trades latency for throughput
+   void setFramesInFlight(uint32_t frameCount);
+   uint32_t getFramesInFlight() const;
+   //off by default, the textures without an up to date .ktx2 are then loaded uncompressed
+   void setCookTexturesOnLoad(bool cook);
 
+   //updates instance 0 of the model
    void updateModelData(size_t index, const glm::mat4& transform, const PushModel& pushData);
+   //adding or removing instances changes the draws, the recordings are redone before the next frame that uses them
+   uint32_t addModelInstance(size_t index, const glm::mat4& transform, const PushModel& pushData);
+   void removeModelInstance(size_t index, uint32_t instanceId);
+   void updateModelInstance(size_t index, uint32_t instanceId, const glm::mat4& transform, const PushModel& pushData);
 
    ~VulkanRenderer();
 
@@ -92,6 +164,7 @@ private:
    void getPhysicalDevice();
    void createLogicalDevice();
    bool checkDeviceSwapChainSupport(VkPhysicalDevice device) const;
+   bool checkDeviceExtensionSupport(VkPhysicalDevice device, const char* extensionName) const;
    DeviceScore checkDeviceSutable(VkPhysicalDevice device) const;
    QueueFamilyIndices getQueueFamilyIndices(VkPhysicalDevice device) const;
    SwapchainDetails getSwapchainDetails(VkPhysicalDevice device, VkSurfaceKHR surface) const;
@@ -100,19 +173,30 @@ private:
    VkExtent2D selectBestResolution(GLFWwindow* window, VkSurfaceCapabilitiesKHR surfaceCapabilityes) const;
    void createSwapChain();
    VkFormat choseOptimalImageFormat(const std::vector<VkFormat> formats, VkImageTiling tiling, VkFormatFeatureFlags flags) const;
+   bool isImageFormatSupported(VkFormat format, VkImageTiling tiling, VkFormatFeatureFlags flags) const;
+   bool openCompressedTexture(const std::string& imageFileName, Ktx2Texture* texture) const;
    void createDepthBuffer();
    void createColorBuffer();
    VkImage createImage(uint32_t width, uint32_t height, VkFormat format, 
-      VkImageTiling tiling, VkImageUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags, VkDeviceMemory* imageMemory ) const;
-   VkImageView createImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) const;
-   VkShaderModule createShaderModule(VkDevice device, const std::vector<char>& code) const;
+      VkImageTiling tiling, VkImageUsageFlags usageFlags, VkMemoryPropertyFlags propertyFlags, MemoryAllocation* imageMemory, uint32_t mipLevels = 1);
+   VkImageView createImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1) const;
    void createRenderPass();
    void createGraphicsPipeline();
    void createFrameBuffers();
    void createCommandPool();
    void allocateCommandBuffers();
-   void recordCommandBuffers(size_t frame);
+   void destroyCommandBuffers();
+   //the command buffer of a frame slot that draws into a swapchain image
+   size_t getRecordingSlot(size_t frame, uint32_t imageIndex) const;
+   void recordCommandBuffers(size_t frame, uint32_t imageIndex);
+   //called by everything that changes what the command buffers record
+   void invalidateRecordings();
+   void createRecordingPools();
+   void destroyRecordingPools();
+   void recordSubPassADraws(VkCommandBuffer commandBuffer, size_t frame, const MeshDraw* draws, size_t drawCount) const;
+   void setViewportAndScissor(VkCommandBuffer commandBuffer) const;
    void createSyncronization();
+   void destroySyncronization();
    void createSubPassADescriptorSetLayout();
    void createSubPassBDescriptorSetLayout();
    void createSubPassASamplerDescriptorSetLayout();
@@ -122,9 +206,25 @@ private:
    void createSubPassBInputDescriptorSet();
    void createUniformBuffers();
    void updateUniformBuffers(size_t frame);
-   void allocateDynamicBufferTransferSpace();
+   size_t getObjectCount() const;
+   void reserveObjectCapacity(size_t objectCount);
+   void createObjectRing(size_t capacity);
+   void writeUniformDescriptor();
+   void writeObjectDescriptor();
    void createTextureSampler();
    void createSamplerDescriptorPool();
+   VkDescriptorPool addSamplerDescriptorPool();
+   VkDescriptorSet allocateTextureSamplerSet(VkDescriptorPool* pool);
+   void writeTextureDescriptor(VkDescriptorSet set, uint32_t arrayElement, VkImageView imageView);
+   uint32_t loadTexture(const char* imageFileName, UploadBatch& uploadBatch);
+   //safe to call from the workers, only reads files and queries the device
+   void decodeTexture(const std::string& imageFileName, DecodedTexture* texture) const;
+   //a handle with one reference, an already loaded texture with the same contents is reused when deduplicate is set
+   uint32_t addDecodedTexture(const DecodedTexture& texture, bool deduplicate, UploadBatch& uploadBatch);
+   void createTexture(const DecodedTexture& texture, uint32_t handle, UploadBatch& uploadBatch);
+   void releaseTexture(uint32_t handle);
+   void destroyTexture(LoadedImage& texture);
+   void retireUploads();
 
    void initAfterResize();
    void cleanupAfterResize();
@@ -136,11 +236,19 @@ private:
       VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
       VkDevice logicalDevice = VK_NULL_HANDLE;
       VkDeviceSize minStorageBufferOffsetAlignment = 0;
+      VkDeviceSize minUniformBufferOffsetAlignment = 0;
+      bool textureCompressionBC = false;
    } mainDevice;
+   DeviceMemoryAllocator memoryAllocator;
+   GeometryPool geometryPool;
+   ThreadPool threadPool;
+   PipelineCache pipelineCache; //used by every pipeline creation, so resizes and later runs skip the compile
+   ShaderLibrary shaderLibrary;
    QueueFamilyIndices queueFamilyIndices;
    SwapchainDetails swapchainDetails;
    VkQueue graphicsQueue = VK_NULL_HANDLE;
    VkQueue presentationQueue = VK_NULL_HANDLE;
+   VkQueue transferQueue = VK_NULL_HANDLE;
    VkSurfaceKHR surface = VK_NULL_HANDLE;
    VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
@@ -156,41 +264,63 @@ private:
    VkRenderPass renderPass = VK_NULL_HANDLE;
    VkPipeline subPassAGraphicsPipeline = VK_NULL_HANDLE;
    VkPipeline subPassBGraphicsPipeline = VK_NULL_HANDLE;
-   std::vector<VkFramebuffer> swapChainFramebuffers;
-   VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+   std::vector<VkFramebuffer> swapChainFramebuffers; //one per recording slot, the attachments of the frame with the swapchain image
+   std::vector<VkCommandPool> frameCommandPools; //one per recording slot, reset as a whole before its command buffer is recorded again
+   VkCommandPool uploadCommandPool = VK_NULL_HANDLE; //short lived upload buffers on the graphics family
+   VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+   UploadQueues uploadQueues;
    std::vector<VkCommandBuffer> commandBuffers;
+   uint64_t recordingsVersion = 1; //bumped by invalidateRecordings
+   std::vector<uint64_t> recordedVersions; //the version each command buffer was recorded at, 0 before the first recording
+   uint32_t recordingThreadCount = 0;
+   std::vector<VkCommandPool> recordingPools; //recordingThreadCount per recording slot
+   std::vector<VkCommandBuffer> secondaryCommandBuffers; //one per recording pool
+   std::vector<MeshDraw> meshDraws;
+   std::vector<double> recordingTimes;
    std::vector<VkSemaphore> imagesAvailable;
-   std::vector<VkFence> drawFences;
+   Timeline frameTimeline; //frame n signals n, the gpu frame counter
+   Timeline uploadTimeline;
+   Timeline copyTimeline;
+   DeletionQueue deletionQueue; //keyed by the frame timeline
+   std::vector<uint64_t> frameValues; //the last frame submitted from each frame slot
+   std::vector<uint64_t> imageFrameValues; //the last frame that drew into each swapchain image
    std::vector<VkSemaphore> rendersFinished;
+   uint32_t framesInFlight = 2; //the sync objects, ring partitions and attachments are per frame
    size_t currentFrame = 0;
 
+   std::vector<UploadTicket> pendingUploads;
+
    std::vector<MeshModel> meshes;
-   size_t modelUniformAlignment = 0;
-   UboModel* modelTransferSpace = nullptr;
-   std::vector<VkBuffer> dynamicUboBuffers; //one per image buffer
-   std::vector<VkDeviceMemory> dynamicUboBuffersMemory;
+   FrameRingBuffer uniformRing; //one partition per frame in flight, written by updateUniformBuffers
+   std::unique_ptr<FrameRingBuffer> objectRing; //one ObjectData per drawn mesh, in the drawing order, replaced when it grows
+   size_t objectCapacity = 0;
 
    struct UboViewProjection
    {
       glm::mat4 projection;
       glm::mat4 view;
    } uboViewProjection;
-   std::vector<VkBuffer> uboBuffers;
-   std::vector<VkDeviceMemory> uboBuffersMemory; //one per image buffer
 
    VkDescriptorSetLayout subPassADescriptorSetLayout = VK_NULL_HANDLE;
    VkDescriptorSetLayout subPassBDescriptorSetLayout = VK_NULL_HANDLE;
    VkDescriptorPool subPassABufferDescriptorPool = VK_NULL_HANDLE;
-   std::vector<VkDescriptorSet> subPassABufferDescriptorSets; //one per spachain image
+   VkDescriptorSet subPassABufferDescriptorSet = VK_NULL_HANDLE; //both bindings are dynamic, the frame is selected by the offsets
 
-   std::vector<VkDescriptorSet> subPassBInputDescriptorSets; //one per spachain image
+   std::vector<VkDescriptorSet> subPassBInputDescriptorSets; //one per frame in flight, like the attachments they read
 
-   std::vector<LoadedImage> loadedTextures;
+   std::vector<LoadedImage> loadedTextures; //indexed by the registry handles, released slots are empty
+   TextureRegistry textureRegistry;
+   uint32_t defaultTextureHandle = TextureRegistry::INVALID_HANDLE; //for the materials without a texture, every model using it holds a reference
    VkSampler textureSampler = VK_NULL_HANDLE;
-   VkDescriptorPool subPassASamplerDescriptorPool;
+   std::vector<VkDescriptorPool> samplerDescriptorPools; //only the first one with bindless textures
    VkDescriptorSetLayout samplerDescriptorSetLayout = VK_NULL_HANDLE;
+   bool useBindlessTextures = false;
+   bool cookTexturesOnLoad = false;
+   uint32_t bindlessTextureCapacity = 0;
+   VkDescriptorSet bindlessTextureSet = VK_NULL_HANDLE; //element i is the texture with handle i, bound once per frame
 
    VkDescriptorPool subPassBInputsDescriptorPool = VK_NULL_HANDLE;
 
    bool useFixedCommandBufferRecordings = false;
+   VertexFormat vertexFormat = VertexFormat::full;
 };
\ No newline at end of file
@@ -0,0 +1,306 @@
+#include "allocator.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+   if (alignment <= 1)
+      return value;
+
+   return (value + alignment - 1) / alignment * alignment;
+}
+
+RangeAllocator::RangeAllocator(VkDeviceSize size) :
+   size(size),
+   freeSize(size)
+{
+   if (size)
+      freeRanges.push_back({ 0, size });
+}
+
+bool RangeAllocator::allocate(VkDeviceSize allocationSize, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+   if (allocationSize == 0 || allocationSize > freeSize)
+      return false;
+
+   for (size_t i = 0; i < freeRanges.size(); ++i)
+   {
+      Range range = freeRanges[i];
+      VkDeviceSize alignedOffset = alignUp(range.offset, alignment);
+      if (alignedOffset + allocationSize > range.offset + range.size)
+         continue;
+
+      VkDeviceSize padding = alignedOffset - range.offset;
+      VkDeviceSize remaining = range.size - padding - allocationSize;
+
+      //keep the padding in front and the tail as free ranges, in offset order
+      freeRanges.erase(freeRanges.begin() + i);
+      if (remaining)
+         freeRanges.insert(freeRanges.begin() + i, { alignedOffset + allocationSize, remaining });
+      if (padding)
+         freeRanges.insert(freeRanges.begin() + i, { range.offset, padding });
+
+      freeSize -= allocationSize;
+      *offset = alignedOffset;
+      return true;
+   }
+
+   return false;
+}
+
+void RangeAllocator::free(VkDeviceSize offset, VkDeviceSize rangeSize)
+{
+   if (rangeSize == 0)
+      return;
+
+   auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset,
+      [](const Range& range, VkDeviceSize value) { return range.offset < value; });
+
+   size_t index = static_cast<size_t>(next - freeRanges.begin());
+   freeRanges.insert(next, { offset, rangeSize });
+   freeSize += rangeSize;
+
+   //merge with the next range
+   if (index + 1 < freeRanges.size() && freeRanges[index].offset + freeRanges[index].size == freeRanges[index + 1].offset)
+   {
+      freeRanges[index].size += freeRanges[index + 1].size;
+      freeRanges.erase(freeRanges.begin() + index + 1);
+   }
+
+   //merge with the previous range
+   if (index > 0 && freeRanges[index - 1].offset + freeRanges[index - 1].size == freeRanges[index].offset)
+   {
+      freeRanges[index - 1].size += freeRanges[index].size;
+      freeRanges.erase(freeRanges.begin() + index);
+   }
+}
+
+VkDeviceSize RangeAllocator::getSize() const
+{
+   return size;
+}
+
+VkDeviceSize RangeAllocator::getFreeSize() const
+{
+   return freeSize;
+}
+
+bool RangeAllocator::empty() const
+{
+   return freeSize == size;
+}
+
+void DeviceMemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize preferredBlockSize)
+{
+   this->physicalDevice = physicalDevice;
+   this->logicalDevice = logicalDevice;
+   this->preferredBlockSize = preferredBlockSize;
+
+   vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+   VkPhysicalDeviceProperties properties = {};
+   vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+   bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+   maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+   nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+}
+
+void DeviceMemoryAllocator::cleanup()
+{
+   for (uint32_t i = 0; i < blocks.size(); ++i)
+      destroyBlock(i);
+
+   blocks.clear();
+}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator()
+{
+   cleanup();
+}
+
+uint32_t DeviceMemoryAllocator::getDeviceAllocationCount() const
+{
+   return deviceAllocationCount;
+}
+
+VkDeviceSize DeviceMemoryAllocator::getBlockSize(uint32_t memoryTypeIndex) const
+{
+   //small heaps (like the host visible device local one) get smaller blocks so they are not exhausted by a few of them
+   VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+   return std::min(preferredBlockSize, std::max<VkDeviceSize>(heapSize / 8, 1024 * 1024));
+}
+
+uint32_t DeviceMemoryAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, AllocationKind kind, bool dedicated)
+{
+   if (maxMemoryAllocationCount && deviceAllocationCount >= maxMemoryAllocationCount)
+      throw std::runtime_error("Reached maxMemoryAllocationCount");
+
+   MemoryBlock block;
+   block.memoryTypeIndex = memoryTypeIndex;
+   block.kind = kind;
+   block.dedicated = dedicated;
+   block.ranges = RangeAllocator(size);
+
+   VkMemoryAllocateInfo allocInfo = {};
+   allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+   allocInfo.allocationSize = size;
+   allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+   if (VK_SUCCESS != vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &block.memory))
+      throw std::runtime_error("Unable to allocate device memory block");
+
+   ++deviceAllocationCount;
+
+   //host visible blocks stay mapped for their whole lifetime, a memory object can't be mapped twice
+   if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+   {
+      if (VK_SUCCESS != vkMapMemory(logicalDevice, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mappedData))
+         throw std::runtime_error("Unable to map device memory block");
+   }
+
+   for (uint32_t i = 0; i < blocks.size(); ++i)
+   {
+      if (blocks[i].memory == VK_NULL_HANDLE)
+      {
+         blocks[i] = std::move(block);
+         return i;
+      }
+   }
+
+   blocks.emplace_back(std::move(block));
+   return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void DeviceMemoryAllocator::destroyBlock(uint32_t blockIndex)
+{
+   MemoryBlock& block = blocks[blockIndex];
+   if (block.memory == VK_NULL_HANDLE)
+      return;
+
+   if (block.mappedData)
+      vkUnmapMemory(logicalDevice, block.memory);
+
+   vkFreeMemory(logicalDevice, block.memory, nullptr);
+   --deviceAllocationCount;
+
+   block = MemoryBlock();
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, AllocationKind kind, VkMemoryPropertyFlags preferredProperties)
+{
+   uint32_t memoryTypeIndex = UINT32_MAX;
+   if (preferredProperties)
+      memoryTypeIndex = findMemoryTypeIndex(physicalDevice, requirements.memoryTypeBits, properties | preferredProperties);
+   if (memoryTypeIndex == UINT32_MAX)
+      memoryTypeIndex = findMemoryTypeIndex(physicalDevice, requirements.memoryTypeBits, properties);
+   if (memoryTypeIndex == UINT32_MAX)
+      throw std::runtime_error("Unable to find a matching memory type");
+
+   VkMemoryPropertyFlags typeProperties = memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+
+   //flushes work on whole atoms, so non coherent allocations must not share one with a neighbour
+   VkDeviceSize alignment = requirements.alignment;
+   VkDeviceSize size = requirements.size;
+   if ((typeProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeProperties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+   {
+      alignment = std::max(alignment, nonCoherentAtomSize);
+      size = alignUp(size, nonCoherentAtomSize);
+   }
+
+   //when the granularity is 1 linear and optimal resources can live next to each other
+   AllocationKind blockKind = bufferImageGranularity > 1 ? kind : AllocationKind::linear;
+
+   VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+
+   MemoryAllocation out;
+   out.memoryTypeIndex = memoryTypeIndex;
+   out.propertyFlags = typeProperties;
+   out.size = size;
+
+   if (size > blockSize / 2)
+   {
+      out.blockIndex = createBlock(memoryTypeIndex, size, blockKind, true);
+      blocks[out.blockIndex].ranges.allocate(size, 1, &out.offset);
+   }
+   else
+   {
+      for (uint32_t i = 0; i < blocks.size(); ++i)
+      {
+         MemoryBlock& block = blocks[i];
+         if (block.memory == VK_NULL_HANDLE || block.dedicated || block.memoryTypeIndex != memoryTypeIndex || block.kind != blockKind)
+            continue;
+
+         if (block.ranges.allocate(size, alignment, &out.offset))
+         {
+            out.blockIndex = i;
+            break;
+         }
+      }
+
+      if (out.blockIndex == UINT32_MAX)
+      {
+         out.blockIndex = createBlock(memoryTypeIndex, blockSize, blockKind, false);
+         blocks[out.blockIndex].ranges.allocate(size, alignment, &out.offset);
+      }
+   }
+
+   const MemoryBlock& block = blocks[out.blockIndex];
+   out.memory = block.memory;
+   if (block.mappedData)
+      out.mappedData = static_cast<char*>(block.mappedData) + out.offset;
+
+   return out;
+}
+
+void DeviceMemoryAllocator::free(MemoryAllocation& allocation)
+{
+   if (allocation.memory == VK_NULL_HANDLE || allocation.blockIndex >= blocks.size())
+   {
+      allocation = MemoryAllocation();
+      return;
+   }
+
+   MemoryBlock& block = blocks[allocation.blockIndex];
+   block.ranges.free(allocation.offset, allocation.size);
+
+   if (block.dedicated)
+   {
+      destroyBlock(allocation.blockIndex);
+   }
+   else if (block.ranges.empty())
+   {
+      //keep one empty block per memory type and kind around to avoid allocation churn
+      for (uint32_t i = 0; i < blocks.size(); ++i)
+      {
+         if (i != allocation.blockIndex && blocks[i].memory != VK_NULL_HANDLE && !blocks[i].dedicated &&
+            blocks[i].memoryTypeIndex == block.memoryTypeIndex && blocks[i].kind == block.kind && blocks[i].ranges.empty())
+         {
+            destroyBlock(allocation.blockIndex);
+            break;
+         }
+      }
+   }
+
+   allocation = MemoryAllocation();
+}
+
+void DeviceMemoryAllocator::flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const
+{
+   if (allocation.memory == VK_NULL_HANDLE || (allocation.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) || size == 0)
+      return;
+
+   //the allocation starts and ends on atom boundaries, so the widened range stays inside it
+   VkDeviceSize begin = (allocation.offset + offset) / nonCoherentAtomSize * nonCoherentAtomSize;
+   VkDeviceSize end = std::min(alignUp(allocation.offset + offset + size, nonCoherentAtomSize), allocation.offset + allocation.size);
+
+   VkMappedMemoryRange range = {};
+   range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+   range.memory = allocation.memory;
+   range.offset = begin;
+   range.size = end - begin;
+
+   if (VK_SUCCESS != vkFlushMappedMemoryRanges(logicalDevice, 1, &range))
+      throw std::runtime_error("Unable to flush mapped memory");
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+
+//first fit free-list over a linear range, free ranges are kept sorted by offset and merged on release
+class RangeAllocator
+{
+public:
+   RangeAllocator() {};
+   explicit RangeAllocator(VkDeviceSize size);
+
+   bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+   void free(VkDeviceSize offset, VkDeviceSize size);
+
+   VkDeviceSize getSize() const;
+   VkDeviceSize getFreeSize() const;
+   bool empty() const;
+
+private:
+   struct Range
+   {
+      VkDeviceSize offset = 0;
+      VkDeviceSize size = 0;
+   };
+
+   std::vector<Range> freeRanges;
+   VkDeviceSize size = 0;
+   VkDeviceSize freeSize = 0;
+};
+
+//buffers and linear images must not share a bufferImageGranularity page with optimal images
+enum class AllocationKind
+{
+   linear,
+   optimal
+};
+
+struct MemoryAllocation
+{
+   VkDeviceMemory memory = VK_NULL_HANDLE;
+   VkDeviceSize offset = 0;
+   VkDeviceSize size = 0;
+   void* mappedData = nullptr; //only for host visible memory, already offset to the start of the allocation
+   VkMemoryPropertyFlags propertyFlags = 0;
+   uint32_t memoryTypeIndex = UINT32_MAX;
+   uint32_t blockIndex = UINT32_MAX;
+};
+
+class DeviceMemoryAllocator
+{
+public:
+   DeviceMemoryAllocator() = default;
+   DeviceMemoryAllocator(const DeviceMemoryAllocator&) = delete;
+   DeviceMemoryAllocator& operator=(const DeviceMemoryAllocator&) = delete;
+
+   void init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize preferredBlockSize = 64 * 1024 * 1024);
+   void cleanup();
+
+   //preferredProperties are added to the required ones when a memory type has all of them
+   MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, AllocationKind kind, VkMemoryPropertyFlags preferredProperties = 0);
+   void free(MemoryAllocation& allocation);
+   //no-op for coherent memory, the range is relative to the start of the allocation
+   void flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+   uint32_t getDeviceAllocationCount() const;
+
+   ~DeviceMemoryAllocator();
+
+private:
+   struct MemoryBlock
+   {
+      VkDeviceMemory memory = VK_NULL_HANDLE;
+      RangeAllocator ranges;
+      uint32_t memoryTypeIndex = UINT32_MAX;
+      AllocationKind kind = AllocationKind::linear;
+      void* mappedData = nullptr;
+      bool dedicated = false;
+   };
+
+   uint32_t createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, AllocationKind kind, bool dedicated);
+   void destroyBlock(uint32_t blockIndex);
+   VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const;
+
+   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   VkPhysicalDeviceMemoryProperties memoryProperties = {};
+   VkDeviceSize preferredBlockSize = 0;
+   VkDeviceSize bufferImageGranularity = 1;
+   VkDeviceSize nonCoherentAtomSize = 1;
+   uint32_t maxMemoryAllocationCount = 0;
+   uint32_t deviceAllocationCount = 0;
+
+   std::vector<MemoryBlock> blocks; //destroyed blocks leave an empty slot so the block indexes stay valid
+};
@@ -0,0 +1,135 @@
+#include "geometrypool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+bool GeometryRange::valid() const
+{
+   return page != UINT32_MAX;
+}
+
+void GeometryPool::init(DeviceMemoryAllocator* allocator, VkDevice logicalDevice, VkDeviceSize vertexStride, VkDeviceSize verticesPerPage, VkDeviceSize indexBytesPerPage)
+{
+   this->allocator = allocator;
+   this->logicalDevice = logicalDevice;
+   this->vertexStride = vertexStride;
+   this->verticesPerPage = verticesPerPage;
+   this->indexBytesPerPage = indexBytesPerPage;
+}
+
+void GeometryPool::cleanup()
+{
+   for (auto& page : pages)
+   {
+      destroyBuffer(*allocator, logicalDevice, &page.vertexBuffer, &page.vertexMemory);
+      destroyBuffer(*allocator, logicalDevice, &page.indexBuffer, &page.indexMemory);
+   }
+   pages.clear();
+}
+
+GeometryPool::~GeometryPool()
+{
+   cleanup();
+}
+
+uint32_t GeometryPool::createPage(VkDeviceSize vertexCapacity, VkDeviceSize indexCapacity)
+{
+   Page page;
+   page.vertices = RangeAllocator(vertexCapacity);
+   page.indices = RangeAllocator(indexCapacity);
+
+   creteBuffer(*allocator, logicalDevice, vertexCapacity * vertexStride,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      &page.vertexBuffer, &page.vertexMemory);
+
+   creteBuffer(*allocator, logicalDevice, indexCapacity,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      &page.indexBuffer, &page.indexMemory);
+
+   pages.emplace_back(std::move(page));
+   return static_cast<uint32_t>(pages.size() - 1);
+}
+
+GeometryRange GeometryPool::allocate(uint32_t vertexCount, uint32_t indexCount, uint32_t indexSize)
+{
+   GeometryRange out;
+   out.vertexCount = vertexCount;
+   out.indexCount = indexCount;
+   out.indexSize = indexSize;
+
+   VkDeviceSize indexBytes = static_cast<VkDeviceSize>(indexCount) * indexSize;
+   VkDeviceSize vertexOffset = 0;
+   VkDeviceSize indexOffset = 0;
+
+   //empty parts take no space, so they fit on any page
+   auto allocateOnPage = [&](Page& page)
+   {
+      if (vertexCount && !page.vertices.allocate(vertexCount, 1, &vertexOffset))
+         return false;
+
+      //firstIndex is counted in indices, so the byte offset must be a multiple of the index size
+      if (indexBytes && !page.indices.allocate(indexBytes, indexSize, &indexOffset))
+      {
+         if (vertexCount)
+            page.vertices.free(vertexOffset, vertexCount);
+         return false;
+      }
+
+      return true;
+   };
+
+   for (uint32_t i = 0; i < pages.size() && !out.valid(); ++i)
+   {
+      if (allocateOnPage(pages[i]))
+         out.page = i;
+   }
+
+   if (!out.valid())
+   {
+      uint32_t page = createPage(std::max<VkDeviceSize>(verticesPerPage, vertexCount), std::max(indexBytesPerPage, indexBytes));
+      if (!allocateOnPage(pages[page]))
+         throw std::runtime_error("Unable to allocate geometry on a new page");
+
+      out.page = page;
+   }
+
+   out.vertexOffset = static_cast<int32_t>(vertexOffset);
+   out.firstIndex = indexBytes ? static_cast<uint32_t>(indexOffset / indexSize) : 0;
+
+   return out;
+}
+
+void GeometryPool::free(GeometryRange& range)
+{
+   if (!range.valid() || range.page >= pages.size())
+      return;
+
+   Page& page = pages[range.page];
+   page.vertices.free(static_cast<VkDeviceSize>(range.vertexOffset), range.vertexCount);
+   page.indices.free(static_cast<VkDeviceSize>(range.firstIndex) * range.indexSize, static_cast<VkDeviceSize>(range.indexCount) * range.indexSize);
+
+   range = GeometryRange();
+}
+
+uint32_t GeometryPool::getPageCount() const
+{
+   return static_cast<uint32_t>(pages.size());
+}
+
+VkBuffer GeometryPool::getVertexBuffer(uint32_t page) const
+{
+   return pages[page].vertexBuffer;
+}
+
+VkBuffer GeometryPool::getIndexBuffer(uint32_t page) const
+{
+   return pages[page].indexBuffer;
+}
+
+VkDeviceSize GeometryPool::getVertexStride() const
+{
+   return vertexStride;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+
+#include "allocator.h"
+
+//where the data of a mesh lives inside the pool, the offsets are the ones vkCmdDrawIndexed expects
+struct GeometryRange
+{
+   uint32_t page = UINT32_MAX;
+   int32_t vertexOffset = 0;
+   uint32_t vertexCount = 0;
+   uint32_t firstIndex = 0;
+   uint32_t indexCount = 0;
+   uint32_t indexSize = 0;
+
+   bool valid() const;
+};
+
+//big shared vertex and index buffers, a new page is only created when no existing one has room for a mesh
+class GeometryPool
+{
+public:
+   GeometryPool() = default;
+   GeometryPool(const GeometryPool&) = delete;
+   GeometryPool& operator=(const GeometryPool&) = delete;
+
+   void init(DeviceMemoryAllocator* allocator, VkDevice logicalDevice, VkDeviceSize vertexStride,
+      VkDeviceSize verticesPerPage = 256 * 1024, VkDeviceSize indexBytesPerPage = 4 * 1024 * 1024);
+   void cleanup();
+
+   GeometryRange allocate(uint32_t vertexCount, uint32_t indexCount, uint32_t indexSize);
+   void free(GeometryRange& range);
+
+   uint32_t getPageCount() const;
+   VkBuffer getVertexBuffer(uint32_t page) const;
+   VkBuffer getIndexBuffer(uint32_t page) const;
+   VkDeviceSize getVertexStride() const;
+
+   ~GeometryPool();
+
+private:
+   struct Page
+   {
+      VkBuffer vertexBuffer = VK_NULL_HANDLE;
+      MemoryAllocation vertexMemory;
+      RangeAllocator vertices; //in vertices
+      VkBuffer indexBuffer = VK_NULL_HANDLE;
+      MemoryAllocation indexMemory;
+      RangeAllocator indices; //in bytes, so pages can mix index types
+   };
+
+   uint32_t createPage(VkDeviceSize vertexCapacity, VkDeviceSize indexCapacity);
+
+   DeviceMemoryAllocator* allocator = nullptr;
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   VkDeviceSize vertexStride = 0;
+   VkDeviceSize verticesPerPage = 0;
+   VkDeviceSize indexBytesPerPage = 0;
+
+   std::vector<Page> pages;
+};
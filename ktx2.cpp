@@ -0,0 +1,284 @@
+#include "ktx2.h"
+
+#include <cstdio>
+#include <cstring>
+
+const uint8_t Ktx2Texture::IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct Ktx2Header
+{
+   uint8_t identifier[12] = {};
+   uint32_t vkFormat = 0;
+   uint32_t typeSize = 0;
+   uint32_t pixelWidth = 0;
+   uint32_t pixelHeight = 0;
+   uint32_t pixelDepth = 0;
+   uint32_t layerCount = 0;
+   uint32_t faceCount = 0;
+   uint32_t levelCount = 0;
+   uint32_t supercompressionScheme = 0;
+   uint32_t dfdByteOffset = 0;
+   uint32_t dfdByteLength = 0;
+   uint32_t kvdByteOffset = 0;
+   uint32_t kvdByteLength = 0;
+   uint64_t sgdByteOffset = 0;
+   uint64_t sgdByteLength = 0;
+};
+
+struct Ktx2LevelIndex
+{
+   uint64_t byteOffset = 0;
+   uint64_t byteLength = 0;
+   uint64_t uncompressedByteLength = 0;
+};
+
+bool Ktx2Texture::open(const std::string& filePath)
+{
+   close();
+
+   if (!file.open(filePath) || file.getSize() < sizeof(Ktx2Header))
+   {
+      close();
+      return false;
+   }
+
+   Ktx2Header header;
+   memcpy(&header, file.getData(), sizeof(header));
+
+   //only what the renderer can upload as it is, cube maps, arrays, 3d images and supercompressed data are rejected
+   bool valid = memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) == 0 &&
+      header.vkFormat != VK_FORMAT_UNDEFINED && header.pixelWidth > 0 && header.pixelHeight > 0 && header.pixelDepth == 0 &&
+      header.layerCount <= 1 && header.faceCount == 1 && header.levelCount > 0 && header.supercompressionScheme == 0 &&
+      sizeof(Ktx2Header) + sizeof(Ktx2LevelIndex) * header.levelCount <= file.getSize() &&
+      static_cast<uint64_t>(header.kvdByteOffset) + header.kvdByteLength <= file.getSize();
+
+   for (uint32_t i = 0; valid && i < header.levelCount; ++i)
+   {
+      Ktx2LevelIndex index;
+      memcpy(&index, file.getData() + sizeof(Ktx2Header) + sizeof(Ktx2LevelIndex) * i, sizeof(index));
+
+      if (index.byteLength == 0 || index.byteOffset + index.byteLength > file.getSize())
+      {
+         valid = false;
+         break;
+      }
+
+      Ktx2Level level;
+      level.offset = index.byteOffset;
+      level.size = index.byteLength;
+      levels.push_back(level);
+   }
+
+   if (!valid)
+   {
+      close();
+      return false;
+   }
+
+   format = static_cast<VkFormat>(header.vkFormat);
+   width = header.pixelWidth;
+   height = header.pixelHeight;
+   keyValueOffset = header.kvdByteOffset;
+   keyValueSize = header.kvdByteLength;
+   return true;
+}
+
+void Ktx2Texture::close()
+{
+   file.close();
+   format = VK_FORMAT_UNDEFINED;
+   width = 0;
+   height = 0;
+   levels.clear();
+   keyValueOffset = 0;
+   keyValueSize = 0;
+}
+
+VkFormat Ktx2Texture::getFormat() const
+{
+   return format;
+}
+
+uint32_t Ktx2Texture::getWidth() const
+{
+   return width;
+}
+
+uint32_t Ktx2Texture::getHeight() const
+{
+   return height;
+}
+
+uint32_t Ktx2Texture::getLevelCount() const
+{
+   return static_cast<uint32_t>(levels.size());
+}
+
+const std::vector<Ktx2Level>& Ktx2Texture::getLevels() const
+{
+   return levels;
+}
+
+const uint8_t* Ktx2Texture::getData() const
+{
+   return file.getData();
+}
+
+bool Ktx2Texture::findKeyValue(const std::string& key, const uint8_t** value, uint32_t* valueSize) const
+{
+   //every entry is a length, a nul terminated key and the value, padded to 4 bytes
+   uint64_t offset = keyValueOffset;
+   uint64_t end = keyValueOffset + keyValueSize;
+   while (offset + sizeof(uint32_t) <= end)
+   {
+      uint32_t length = 0;
+      memcpy(&length, file.getData() + offset, sizeof(length));
+      offset += sizeof(length);
+      if (offset + length > end)
+         return false;
+
+      const char* entry = reinterpret_cast<const char*>(file.getData() + offset);
+      size_t keyLength = strnlen(entry, length);
+      if (keyLength < length && key == std::string(entry, keyLength))
+      {
+         *value = file.getData() + offset + keyLength + 1;
+         *valueSize = static_cast<uint32_t>(length - keyLength - 1);
+         return true;
+      }
+
+      offset += (length + 3) / 4 * 4;
+   }
+
+   return false;
+}
+
+//the data format descriptor of the block compressed formats the cooker writes, see the khronos data format specification
+static bool getBlockDescriptor(VkFormat format, uint8_t* colorModel, std::vector<uint32_t>* samples)
+{
+   static const uint32_t SAMPLE_COLOR = 0;
+   static const uint32_t SAMPLE_ALPHA = 15;
+
+   //bit offset, bit length - 1, channel
+   auto sample = [samples](uint32_t bitOffset, uint32_t bitLength, uint32_t channel)
+   {
+      samples->push_back(bitOffset | ((bitLength - 1) << 16) | (channel << 24));
+      samples->push_back(0);
+      samples->push_back(0);
+      samples->push_back(UINT32_MAX);
+   };
+
+   switch (format)
+   {
+   case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+      *colorModel = 128;
+      sample(0, 64, SAMPLE_COLOR);
+      return true;
+   case VK_FORMAT_BC3_UNORM_BLOCK:
+      *colorModel = 130;
+      sample(0, 64, SAMPLE_ALPHA);
+      sample(64, 64, SAMPLE_COLOR);
+      return true;
+   case VK_FORMAT_BC7_UNORM_BLOCK:
+      *colorModel = 134;
+      sample(0, 128, SAMPLE_COLOR);
+      return true;
+   default:
+      return false;
+   }
+}
+
+static void writePadding(FILE* file, uint64_t* offset, uint64_t alignment)
+{
+   static const uint8_t zeros[16] = {};
+   uint64_t alignedOffset = (*offset + alignment - 1) / alignment * alignment;
+   fwrite(zeros, 1, static_cast<size_t>(alignedOffset - *offset), file);
+   *offset = alignedOffset;
+}
+
+bool Ktx2Texture::write(const std::string& filePath, VkFormat format, uint32_t width, uint32_t height, uint32_t blockSize,
+   const std::vector<std::vector<uint8_t>>& levels, const std::vector<std::pair<std::string, std::vector<uint8_t>>>& keyValues)
+{
+   uint8_t colorModel = 0;
+   std::vector<uint32_t> samples;
+   if (levels.empty() || !getBlockDescriptor(format, &colorModel, &samples))
+      return false;
+
+   std::vector<uint32_t> descriptor;
+   uint32_t blockDescriptorSize = static_cast<uint32_t>(6 * sizeof(uint32_t) + samples.size() * sizeof(uint32_t));
+   descriptor.push_back(static_cast<uint32_t>(sizeof(uint32_t)) + blockDescriptorSize);
+   descriptor.push_back(0); //khronos vendor, basic descriptor block
+   descriptor.push_back(2 | (blockDescriptorSize << 16));
+   descriptor.push_back(colorModel | (1 << 8) | (1 << 16)); //bt709 primaries, linear transfer, straight alpha
+   descriptor.push_back(3 | (3 << 8)); //4x4x1x1 texel blocks
+   descriptor.push_back(blockSize);
+   descriptor.push_back(0);
+   descriptor.insert(descriptor.end(), samples.begin(), samples.end());
+
+   std::vector<uint8_t> keyValueData;
+   for (const auto& keyValue : keyValues)
+   {
+      uint32_t length = static_cast<uint32_t>(keyValue.first.size() + 1 + keyValue.second.size());
+      const uint8_t* lengthBytes = reinterpret_cast<const uint8_t*>(&length);
+      keyValueData.insert(keyValueData.end(), lengthBytes, lengthBytes + sizeof(length));
+      keyValueData.insert(keyValueData.end(), keyValue.first.begin(), keyValue.first.end());
+      keyValueData.push_back(0);
+      keyValueData.insert(keyValueData.end(), keyValue.second.begin(), keyValue.second.end());
+      keyValueData.resize((keyValueData.size() + 3) / 4 * 4, 0);
+   }
+
+   Ktx2Header header;
+   memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+   header.vkFormat = static_cast<uint32_t>(format);
+   header.typeSize = 1;
+   header.pixelWidth = width;
+   header.pixelHeight = height;
+   header.faceCount = 1;
+   header.levelCount = static_cast<uint32_t>(levels.size());
+   header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + sizeof(Ktx2LevelIndex) * levels.size());
+   header.dfdByteLength = static_cast<uint32_t>(descriptor.size() * sizeof(uint32_t));
+   header.kvdByteOffset = keyValueData.empty() ? 0 : header.dfdByteOffset + header.dfdByteLength;
+   header.kvdByteLength = static_cast<uint32_t>(keyValueData.size());
+
+   //the smallest level is stored first, each one aligned to the block size
+   std::vector<Ktx2LevelIndex> levelIndices(levels.size());
+   uint64_t offset = header.dfdByteOffset + header.dfdByteLength + header.kvdByteLength;
+   for (size_t i = levels.size(); i-- > 0;)
+   {
+      offset = (offset + blockSize - 1) / blockSize * blockSize;
+      levelIndices[i].byteOffset = offset;
+      levelIndices[i].byteLength = levels[i].size();
+      levelIndices[i].uncompressedByteLength = levels[i].size();
+      offset += levels[i].size();
+   }
+
+   //written to a temporary file first, like the mesh cache
+   std::string temporaryPath = filePath + ".tmp";
+   FILE* file = fopen(temporaryPath.c_str(), "wb");
+   if (!file)
+      return false;
+
+   fwrite(&header, sizeof(header), 1, file);
+   fwrite(levelIndices.data(), sizeof(Ktx2LevelIndex), levelIndices.size(), file);
+   fwrite(descriptor.data(), sizeof(uint32_t), descriptor.size(), file);
+   fwrite(keyValueData.data(), 1, keyValueData.size(), file);
+
+   offset = header.dfdByteOffset + header.dfdByteLength + header.kvdByteLength;
+   for (size_t i = levels.size(); i-- > 0;)
+   {
+      writePadding(file, &offset, blockSize);
+      fwrite(levels[i].data(), 1, levels[i].size(), file);
+      offset += levels[i].size();
+   }
+
+   bool failed = ferror(file) != 0;
+   fclose(file);
+
+   if (failed)
+   {
+      remove(temporaryPath.c_str());
+      return false;
+   }
+
+   remove(filePath.c_str());
+   return rename(temporaryPath.c_str(), filePath.c_str()) == 0;
+}
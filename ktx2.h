@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+#include "utils.h"
+
+//one mip level, offset and size are in bytes from the start of the file
+struct Ktx2Level
+{
+   uint64_t offset = 0;
+   uint64_t size = 0;
+};
+
+//read only view of a KTX2 file with a single 2d image and no supercompression, the levels are copied straight to the gpu
+class Ktx2Texture
+{
+public:
+   static const uint8_t IDENTIFIER[12];
+
+   Ktx2Texture() = default;
+   Ktx2Texture(const Ktx2Texture&) = delete;
+   Ktx2Texture& operator=(const Ktx2Texture&) = delete;
+
+   bool open(const std::string& filePath);
+   void close();
+
+   VkFormat getFormat() const;
+   uint32_t getWidth() const;
+   uint32_t getHeight() const;
+   uint32_t getLevelCount() const;
+   //level 0 is the largest one
+   const std::vector<Ktx2Level>& getLevels() const;
+   const uint8_t* getData() const;
+
+   //false when the key is missing
+   bool findKeyValue(const std::string& key, const uint8_t** value, uint32_t* valueSize) const;
+
+   static bool write(const std::string& filePath, VkFormat format, uint32_t width, uint32_t height, uint32_t blockSize,
+      const std::vector<std::vector<uint8_t>>& levels, const std::vector<std::pair<std::string, std::vector<uint8_t>>>& keyValues);
+
+private:
+   MappedFile file;
+   VkFormat format = VK_FORMAT_UNDEFINED;
+   uint32_t width = 0;
+   uint32_t height = 0;
+   std::vector<Ktx2Level> levels;
+   uint64_t keyValueOffset = 0;
+   uint32_t keyValueSize = 0;
+};
@@ -1,10 +1,12 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 
 #include "VulkanRenderer.h"
 #include "utils.h"
 #include "mesh.h"
+#include "texturecooker.h"
 #include <assimp/Importer.hpp>
 
 GLFWwindow* createWindow(const std::string& name = "test window", const int width = 800, const int height = 600)
@@ -24,18 +26,55 @@ void destroyWindow(GLFWwindow** window)
    glfwTerminate();
 }
 
+//textures are cooked ahead of time with --cook-textures file..., loadTexture only cooks the missing ones with --cook-textures-on-load
+static int cookTextures(int argc, char** argv)
+{
+   int result = EXIT_SUCCESS;
+   for (int i = 2; i < argc; ++i)
+   {
+      bool cooked = cookTexture(argv[i], getCookedTexturePath(argv[i]));
+      printf("%s : %s\n", argv[i], cooked ? "cooked" : "failed");
+      if (!cooked)
+         result = EXIT_FAILURE;
+   }
+   return result;
+}
+
 #ifdef WINMAIN
 int WinMain()
 #else
-int main()
+int main(int argc, char** argv)
 #endif
 {
+   //--recording-threads n splits the draws of a frame between n secondary command buffers and prints their recording times
+   //--frames-in-flight n lets the cpu run up to n frames ahead of the gpu, 1 to 4
+   //--cook-textures-on-load writes the missing .ktx2 files while loading, it can take seconds per texture
+   uint32_t recordingThreads = 0;
+   uint32_t framesInFlight = 2;
+   bool cookTexturesOnLoad = false;
+#ifndef WINMAIN
+   if (argc > 1 && strcmp(argv[1], "--cook-textures") == 0)
+      return cookTextures(argc, argv);
+   for (int i = 1; i < argc; ++i)
+   {
+      if (strcmp(argv[i], "--cook-textures-on-load") == 0)
+         cookTexturesOnLoad = true;
+      else if (i + 1 < argc && strcmp(argv[i], "--recording-threads") == 0)
+         recordingThreads = static_cast<uint32_t>(atoi(argv[++i]));
+      else if (i + 1 < argc && strcmp(argv[i], "--frames-in-flight") == 0)
+         framesInFlight = static_cast<uint32_t>(atoi(argv[++i]));
+   }
+#endif
+
    GLFWwindow* window = createWindow();
 
    {
       VulkanRenderer vulkanRenderer;
+      vulkanRenderer.setFramesInFlight(framesInFlight);
+      vulkanRenderer.setCookTexturesOnLoad(cookTexturesOnLoad);
       if (EXIT_FAILURE == vulkanRenderer.init(window, false))
          return EXIT_FAILURE;
+      vulkanRenderer.setRecordingThreadCount(recordingThreads);
 
       uint32_t catModelIndex = vulkanRenderer.loadModel("cat.obj");
 
@@ -45,6 +84,7 @@ int main()
       vulkanRenderer.updateRenderCommands();
 
       double lastTime = 0.0f;
+      double lastReportTime = 0.0f;
       float angle = 0.0f;
       float glowFactor = 0.0f;
       bool glowDirection = true;
@@ -83,6 +123,15 @@ int main()
             break;
          }
          glfwPollEvents();
+
+         if (recordingThreads > 0 && currentTime - lastReportTime > 2.0)
+         {
+            lastReportTime = currentTime;
+            printf("recording :");
+            for (double chunkTime : vulkanRenderer.getRecordingTimes())
+               printf(" %.3f ms", chunkTime);
+            printf("\n");
+         }
       }
    }
 
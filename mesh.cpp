@@ -1,36 +1,30 @@
 #include "mesh.h"
 #include "utils.h"
 
+#include <gtc/packing.hpp>
+
 #include <stdexcept>
+#include <algorithm>
 
 
-Mesh::Mesh(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices, size_t textureId) :
-   vertexCount(static_cast<uint32_t>(vertices.size())),
-   indicesCount(static_cast<uint32_t>(indices.size())),
-   logicalDevice(logicalDevice),
-   textureId(textureId)
+Mesh::Mesh(GeometryPool* geometryPool, UploadBatch& uploadBatch, const CookedMeshView& cookedMesh, size_t textureId) :
+   bounds(cookedMesh.bounds),
+   textureId(textureId),
+   geometryPool(geometryPool)
 {
-   createVertexBuffer(physicalDevice, logicalDevice, transferQueue, transferCommandPool, vertices, indices);
+   createVertexBuffer(uploadBatch, cookedMesh);
 }
 
 Mesh::Mesh(Mesh&& other) :
-vertexCount(other.vertexCount),
-indicesCount(other.indicesCount),
-verticesBuffer(other.verticesBuffer),
-verticesMemory(other.verticesMemory),
-indicesBuffer(other.indicesBuffer),
-indicesMemory(other.indicesMemory),
-logicalDevice(other.logicalDevice),
-textureId(other.textureId)
-{
-   other.vertexCount = 0;
-   other.indicesCount = 0;
-   other.verticesBuffer = VK_NULL_HANDLE;
-   other.verticesMemory = VK_NULL_HANDLE;
-   other.indicesBuffer = VK_NULL_HANDLE;
-   other.indicesMemory = VK_NULL_HANDLE;
+geometry(other.geometry),
+bounds(other.bounds),
+textureId(other.textureId),
+geometryPool(other.geometryPool)
+{
+   other.geometry = GeometryRange();
+   other.bounds = PushMeshBounds();
    other.textureId = 0;
-   other.logicalDevice = VK_NULL_HANDLE;
+   other.geometryPool = nullptr;
 }
 
 Mesh::~Mesh()
@@ -40,112 +34,207 @@ Mesh::~Mesh()
 
 uint32_t Mesh::getVertexCount() const
 {
-   return vertexCount;
+   return geometry.vertexCount;
 }
 
 uint32_t Mesh::getIndicesCount() const
 {
-   return indicesCount;
+   return geometry.indexCount;
 }
 
 VkBuffer Mesh::getVertexBuffer() const
 {
-   return verticesBuffer;
+   return geometryPool->getVertexBuffer(geometry.page);
 }
 
 VkBuffer Mesh::getIndexBuffer() const
 {
-   return indicesBuffer;
+   return geometryPool->getIndexBuffer(geometry.page);
 }
 
-const size_t Mesh::getTextureId() const
+uint32_t Mesh::getGeometryPage() const
 {
-    return textureId;
+   return geometry.page;
 }
 
-void Mesh::clean()
+uint32_t Mesh::getFirstIndex() const
 {
-   if (indicesMemory != VK_NULL_HANDLE)
-      vkFreeMemory(logicalDevice, indicesMemory, nullptr);
-
-   indicesMemory = VK_NULL_HANDLE;
-
-   if (indicesBuffer)
-      vkDestroyBuffer(logicalDevice, indicesBuffer, nullptr);
-
-   indicesBuffer = VK_NULL_HANDLE;
-
-   if (verticesMemory != VK_NULL_HANDLE)
-      vkFreeMemory(logicalDevice, verticesMemory, nullptr);
-
-   verticesMemory = VK_NULL_HANDLE;
-
-   if (verticesBuffer)
-      vkDestroyBuffer(logicalDevice, verticesBuffer, nullptr);
-
-   verticesBuffer = VK_NULL_HANDLE;
-   vertexCount = 0;
+   return geometry.firstIndex;
 }
 
-void Mesh::createVertexBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices)
+int32_t Mesh::getVertexOffset() const
 {
-   VkBuffer stagingBuffer = VK_NULL_HANDLE;
-   VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+   return geometry.vertexOffset;
+}
 
-   creteBuffer(physicalDevice, logicalDevice, 
-      std::max(sizeof(Vertex) * vertices.size(), sizeof(uint16_t) * indices.size()),
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      &stagingBuffer, &stagingMemory);
+VkIndexType Mesh::getIndexType() const
+{
+   return geometry.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
 
-   creteBuffer(physicalDevice, logicalDevice, sizeof(Vertex) * vertices.size(),
-      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      &verticesBuffer, &verticesMemory);
+const PushMeshBounds& Mesh::getBounds() const
+{
+   return bounds;
+}
 
-   creteBuffer(physicalDevice, logicalDevice, sizeof(uint16_t) * indices.size(),
-      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      &indicesBuffer, &indicesMemory);
+const size_t Mesh::getTextureId() const
+{
+    return textureId;
+}
 
-   void* mappedData = nullptr;
-   if (VK_SUCCESS != vkMapMemory(logicalDevice, stagingMemory, 0, sizeof(Vertex) * vertices.size(), 0, &mappedData))
-      throw std::runtime_error("Unable to bind buffer memory");
+void Mesh::setTextureId(size_t textureId)
+{
+   this->textureId = textureId;
+}
 
-   memcpy(mappedData, vertices.data(), vertices.size() * sizeof(Vertex));
+void Mesh::clean()
+{
+   //the range goes back to the pool, the caller must make sure the gpu is no longer reading it
+   if (geometryPool)
+      geometryPool->free(geometry);
 
-   vkUnmapMemory(logicalDevice, stagingMemory);
-   mappedData = nullptr;
+   geometry = GeometryRange();
+}
 
-   copyBuffer(logicalDevice, transferQueue, transferCommandPool, verticesBuffer, stagingBuffer, sizeof(Vertex) * vertices.size());
+static std::vector<PackedVertex> packVertices(const std::vector<Vertex>& vertices, PushMeshBounds* bounds)
+{
+   glm::vec3 minPosition = vertices.empty() ? glm::vec3(0.0f) : vertices[0].position;
+   glm::vec3 maxPosition = minPosition;
+   for (const auto& v : vertices)
+   {
+      minPosition = glm::min(minPosition, v.position);
+      maxPosition = glm::max(maxPosition, v.position);
+   }
+
+   glm::vec3 extent = maxPosition - minPosition;
+   bounds->offset = glm::vec4(minPosition, 0.0f);
+   bounds->scale = glm::vec4(extent, 0.0f);
+
+   std::vector<PackedVertex> out(vertices.size());
+   for (size_t i = 0; i < vertices.size(); ++i)
+   {
+      for (glm::length_t c = 0; c < 3; ++c)
+      {
+         float normalized = extent[c] > 0.0f ? (vertices[i].position[c] - minPosition[c]) / extent[c] : 0.0f;
+         out[i].position[c] = static_cast<uint16_t>(glm::round(glm::clamp(normalized, 0.0f, 1.0f) * 65535.0f));
+
+         out[i].color[c] = static_cast<uint8_t>(glm::round(glm::clamp(vertices[i].color[c], 0.0f, 1.0f) * 255.0f));
+      }
+      out[i].color[3] = 255;
+      out[i].uv = glm::packHalf2x16(vertices[i].uv);
+   }
+
+   return out;
+}
 
-   if (VK_SUCCESS != vkMapMemory(logicalDevice, stagingMemory, 0, sizeof(uint16_t) * indices.size(), 0, &mappedData))
-      throw std::runtime_error("Unable to bind buffer memory");
+void Mesh::createVertexBuffer(UploadBatch& uploadBatch, const CookedMeshView& cookedMesh)
+{
+   geometry = geometryPool->allocate(cookedMesh.vertexCount, cookedMesh.indexCount, cookedMesh.indexSize);
 
-   memcpy(mappedData, indices.data(), indices.size() * sizeof(uint16_t));
+   VkDeviceSize vertexStride = geometryPool->getVertexStride();
+   uploadBatch.uploadBuffer(getVertexBuffer(), geometry.vertexOffset * vertexStride, cookedMesh.vertexData, vertexStride * cookedMesh.vertexCount);
+   uploadBatch.uploadBuffer(getIndexBuffer(), static_cast<VkDeviceSize>(geometry.firstIndex) * cookedMesh.indexSize, cookedMesh.indexData, static_cast<VkDeviceSize>(cookedMesh.indexSize) * cookedMesh.indexCount);
+}
 
-   vkUnmapMemory(logicalDevice, stagingMemory);
-   mappedData = nullptr;
+CookedMeshView CookedMesh::view() const
+{
+   CookedMeshView out;
+   out.vertexData = vertexData.data();
+   out.indexData = indexData.data();
+   out.vertexCount = vertexCount;
+   out.indexCount = indexCount;
+   out.indexSize = indexSize;
+   out.materialIndex = materialIndex;
+   out.bounds = bounds;
+   return out;
+}
 
-   copyBuffer(logicalDevice, transferQueue, transferCommandPool, indicesBuffer, stagingBuffer, sizeof(uint16_t) * indices.size());
+template<typename T>
+static void appendBytes(std::vector<uint8_t>& out, const T* data, size_t count)
+{
+   const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+   out.insert(out.end(), bytes, bytes + sizeof(T) * count);
+}
 
-   vkFreeMemory(logicalDevice, stagingMemory, nullptr);
-   vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
+CookedMesh cookMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, VertexFormat vertexFormat, uint32_t materialIndex)
+{
+   CookedMesh out;
+   out.vertexCount = static_cast<uint32_t>(vertices.size());
+   out.indexCount = static_cast<uint32_t>(indices.size());
+   out.materialIndex = materialIndex;
+
+   if (vertexFormat == VertexFormat::packed)
+   {
+      std::vector<PackedVertex> packedVertices = packVertices(vertices, &out.bounds);
+      appendBytes(out.vertexData, packedVertices.data(), packedVertices.size());
+   }
+   else
+   {
+      appendBytes(out.vertexData, vertices.data(), vertices.size());
+   }
+
+   if (vertices.size() <= Mesh::MAX_SHORT_INDEX_VERTICES)
+   {
+      std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+      out.indexSize = sizeof(uint16_t);
+      appendBytes(out.indexData, shortIndices.data(), shortIndices.size());
+   }
+   else
+   {
+      out.indexSize = sizeof(uint32_t);
+      appendBytes(out.indexData, indices.data(), indices.size());
+   }
+
+   return out;
 }
 
-MeshModel::MeshModel(std::vector<Mesh>&& meshList) :
-meshList(std::move(meshList))
+std::vector<MeshData> splitForShortIndices(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
 {
+   std::vector<MeshData> out;
+   std::vector<uint32_t> remap(vertices.size(), UINT32_MAX); //chunk local index of each vertex, UINT32_MAX when not in the current chunk
+
+   MeshData chunk;
+   for (size_t i = 0; i + 2 < indices.size(); i += 3)
+   {
+      uint32_t newVertices = 0;
+      for (size_t j = 0; j < 3; ++j)
+         if (remap[indices[i + j]] == UINT32_MAX)
+            ++newVertices;
+
+      if (chunk.vertices.size() + newVertices > Mesh::MAX_SHORT_INDEX_VERTICES)
+      {
+         out.emplace_back(std::move(chunk));
+         chunk = MeshData();
+         std::fill(remap.begin(), remap.end(), UINT32_MAX);
+      }
+
+      for (size_t j = 0; j < 3; ++j)
+      {
+         uint32_t& local = remap[indices[i + j]];
+         if (local == UINT32_MAX)
+         {
+            local = static_cast<uint32_t>(chunk.vertices.size());
+            chunk.vertices.push_back(vertices[indices[i + j]]);
+         }
+         chunk.indices.push_back(local);
+      }
+   }
+
+   if (!chunk.indices.empty())
+      out.emplace_back(std::move(chunk));
+
+   return out;
 }
 
-MeshModel::~MeshModel()
+MeshModel::MeshModel(std::vector<Mesh>&& meshList, std::vector<uint32_t>&& textureHandles) :
+meshList(std::move(meshList)), textureHandles(std::move(textureHandles))
 {
-   clean();
+   addInstance(glm::identity<glm::mat4>(), PushModel());
 }
 
-void MeshModel::setModel(const glm::mat4& model)
+MeshModel::~MeshModel()
 {
-   this->model = model;
+   clean();
 }
 
 uint32_t MeshModel::getMeshCount() const
@@ -167,19 +256,110 @@ void MeshModel::clean()
       m.clean();
 
    meshList.clear();
+   textureHandles.clear();
+
+   instances.clear();
+   instanceIds.clear();
+   instanceIndices.clear();
+   freeInstanceIds.clear();
+}
+
+uint32_t MeshModel::addInstance(const glm::mat4& transform, const PushModel& pushData)
+{
+   uint32_t instanceId = static_cast<uint32_t>(instanceIndices.size());
+   if (!freeInstanceIds.empty())
+   {
+      instanceId = freeInstanceIds.back();
+      freeInstanceIds.pop_back();
+   }
+   else
+   {
+      instanceIndices.push_back(UINT32_MAX);
+   }
+
+   instanceIndices[instanceId] = static_cast<uint32_t>(instances.size());
+   instanceIds.push_back(instanceId);
+
+   ObjectData instance;
+   instance.model = transform;
+   instance.color = glm::vec4(pushData.color, 1.0f);
+   instances.push_back(instance);
+
+   return instanceId;
+}
+
+bool MeshModel::removeInstance(uint32_t instanceId)
+{
+   if (instanceId >= instanceIndices.size() || instanceIndices[instanceId] == UINT32_MAX)
+      return false;
+
+   uint32_t index = instanceIndices[instanceId];
+   uint32_t lastIndex = static_cast<uint32_t>(instances.size() - 1);
+
+   instances[index] = instances[lastIndex];
+   instanceIds[index] = instanceIds[lastIndex];
+   instanceIndices[instanceIds[index]] = index;
+
+   instances.pop_back();
+   instanceIds.pop_back();
+
+   instanceIndices[instanceId] = UINT32_MAX;
+   freeInstanceIds.push_back(instanceId);
+
+   return true;
+}
+
+bool MeshModel::updateInstance(uint32_t instanceId, const glm::mat4& transform, const PushModel& pushData)
+{
+   if (instanceId >= instanceIndices.size() || instanceIndices[instanceId] == UINT32_MAX)
+      return false;
+
+   ObjectData& instance = instances[instanceIndices[instanceId]];
+   instance.model = transform;
+   instance.color = glm::vec4(pushData.color, 1.0f);
+
+   return true;
+}
+
+uint32_t MeshModel::getInstanceCount() const
+{
+   return static_cast<uint32_t>(instances.size());
 }
 
-const glm::mat4& MeshModel::getModel() const
+const std::vector<ObjectData>& MeshModel::getInstances() const
 {
-   return model;
+   return instances;
 }
 
-const PushModel& MeshModel::getPushData() const
+const std::vector<uint32_t>& MeshModel::getTextureHandles() const
 {
-   return pushModel;
+   return textureHandles;
 }
 
-void MeshModel::setPushData(const PushModel& in)
+bool MeshModel::setMeshTexture(uint32_t meshIndex, uint32_t textureHandle, std::vector<uint32_t>* releasedHandles)
 {
-   pushModel = in;
+   if (meshIndex >= meshList.size())
+      return false;
+
+   uint32_t oldHandle = static_cast<uint32_t>(meshList[meshIndex].getTextureId());
+   meshList[meshIndex].setTextureId(textureHandle);
+
+   //one reference per texture, a texture the model already holds does not need the new one
+   if (std::find(textureHandles.begin(), textureHandles.end(), textureHandle) == textureHandles.end())
+      textureHandles.push_back(textureHandle);
+   else
+      releasedHandles->push_back(textureHandle);
+
+   //the old texture is kept while other meshes of the model still use it
+   for (const auto& m : meshList)
+      if (m.getTextureId() == oldHandle)
+         return true;
+
+   auto oldEntry = std::find(textureHandles.begin(), textureHandles.end(), oldHandle);
+   if (oldEntry != textureHandles.end())
+   {
+      textureHandles.erase(oldEntry);
+      releasedHandles->push_back(oldHandle);
+   }
+   return true;
 }
@@ -6,6 +6,10 @@
 #include <vulkan/vulkan.h>
 #include <vector>
 
+#include "allocator.h"
+#include "upload.h"
+#include "geometrypool.h"
+
 struct Vertex
 {
    glm::vec3 position = {};
@@ -13,9 +17,32 @@ struct Vertex
    glm::vec2 uv = {};
 };
 
-struct UboModel
+//16 bytes instead of 32, the position is relative to the mesh bounds and is restored in shader.vert with PushMeshBounds
+struct PackedVertex
+{
+   uint16_t position[4] = {}; //R16G16B16A16_UNORM, w is unused
+   uint32_t uv = 0; //R16G16_SFLOAT
+   uint8_t color[4] = {}; //R8G8B8A8_UNORM
+};
+
+enum class VertexFormat
+{
+   full,
+   packed
+};
+
+//position = offset + attribute position * scale, an identity transform for full vertices
+struct PushMeshBounds
+{
+   glm::vec4 offset = { 0.0f, 0.0f, 0.0f, 0.0f };
+   glm::vec4 scale = { 1.0f, 1.0f, 1.0f, 0.0f };
+};
+
+//one per drawn instance, std430 layout, matches the Objects storage buffer in shader.vert
+struct ObjectData
 {
    glm::mat4 model = glm::identity<glm::mat4>();
+   glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f };
 };
 
 struct PushModel
@@ -23,46 +50,90 @@ struct PushModel
    glm::vec3 color = { 1.0f, 1.0f, 1.0f };
 };
 
+//vertices and indices of a mesh before they are uploaded
+struct MeshData
+{
+   std::vector<Vertex> vertices;
+   std::vector<uint32_t> indices;
+};
+
+//points to mesh data that already has the layout of the geometry pool, either a CookedMesh or a mapped mesh cache
+struct CookedMeshView
+{
+   const void* vertexData = nullptr;
+   const void* indexData = nullptr;
+   uint32_t vertexCount = 0;
+   uint32_t indexCount = 0;
+   uint32_t indexSize = 0; //2 or 4
+   uint32_t materialIndex = 0;
+   PushMeshBounds bounds;
+};
+
+struct CookedMesh
+{
+   std::vector<uint8_t> vertexData;
+   std::vector<uint8_t> indexData;
+   uint32_t vertexCount = 0;
+   uint32_t indexCount = 0;
+   uint32_t indexSize = 0;
+   uint32_t materialIndex = 0;
+   PushMeshBounds bounds;
+
+   CookedMeshView view() const;
+};
+
+//splits the triangles in chunks that reference at most MAX_SHORT_INDEX_VERTICES vertices each, so every chunk can use uint16 indices
+std::vector<MeshData> splitForShortIndices(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+//converts the vertices to vertexFormat and the indices to uint16 when the mesh has few enough vertices
+CookedMesh cookMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, VertexFormat vertexFormat, uint32_t materialIndex);
+
 class Mesh
 {
 public:
+   static const uint32_t MAX_SHORT_INDEX_VERTICES = 65536;
+
    Mesh() {};
    Mesh(Mesh&& other);
-   Mesh(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices, size_t textureId);
+   //the indices are stored as uint16 when the mesh has few enough vertices, as uint32 otherwise
+   //the vertex data must have the stride the geometry pool was created with, it is copied to staging memory by the constructor
+   Mesh(GeometryPool* geometryPool, UploadBatch& uploadBatch, const CookedMeshView& cookedMesh, size_t textureId);
    Mesh(const Mesh& other) = delete;
    Mesh& operator=(Mesh&& other) = delete;
    Mesh& operator=(const Mesh& other) = delete;
 
    uint32_t getVertexCount() const;
    uint32_t getIndicesCount() const;
+   //the buffers are shared with other meshes, draw with getFirstIndex and getVertexOffset
    VkBuffer getVertexBuffer() const;
    VkBuffer getIndexBuffer() const;
+   uint32_t getGeometryPage() const;
+   uint32_t getFirstIndex() const;
+   int32_t getVertexOffset() const;
+   VkIndexType getIndexType() const;
+   const PushMeshBounds& getBounds() const;
 
    const size_t getTextureId() const;
+   void setTextureId(size_t textureId);
 
    void clean();
 
    ~Mesh();
 
 private:
-   uint32_t vertexCount = 0;
-   uint32_t indicesCount = 0;
-   VkBuffer verticesBuffer = VK_NULL_HANDLE;
-   VkDeviceMemory verticesMemory = VK_NULL_HANDLE;
-   VkBuffer indicesBuffer = VK_NULL_HANDLE;
-   VkDeviceMemory indicesMemory = VK_NULL_HANDLE;
+   GeometryRange geometry;
+   PushMeshBounds bounds;
 
    size_t textureId = 0;
 
-   VkDevice logicalDevice = VK_NULL_HANDLE;
+   GeometryPool* geometryPool = nullptr;
 
-   void createVertexBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices);
+   void createVertexBuffer(UploadBatch& uploadBatch, const CookedMeshView& cookedMesh);
 };
 
 class MeshModel
 {
 public:
-   MeshModel(std::vector<Mesh>&& meshList);
+   MeshModel(std::vector<Mesh>&& meshList, std::vector<uint32_t>&& textureHandles = {});
    MeshModel(MeshModel&&) = default;
    MeshModel() = delete;
    MeshModel(const MeshModel&) = delete;
@@ -73,17 +144,28 @@ public:
 
    const Mesh* getMesh(uint32_t index) const;
 
-   const glm::mat4& getModel() const;
-   void setModel(const glm::mat4&);
+   //instance ids stay valid until the instance is removed, a new model starts with instance 0
+   uint32_t addInstance(const glm::mat4& transform, const PushModel& pushData);
+   bool removeInstance(uint32_t instanceId);
+   bool updateInstance(uint32_t instanceId, const glm::mat4& transform, const PushModel& pushData);
 
-   const PushModel& getPushData() const;
-   void setPushData(const PushModel&);
+   uint32_t getInstanceCount() const;
+   const std::vector<ObjectData>& getInstances() const;
+
+   //one entry per texture reference the model holds, the renderer releases them when the model is unloaded
+   const std::vector<uint32_t>& getTextureHandles() const;
+   //the model takes over a reference to the texture, releasedHandles gets the references it no longer needs
+   bool setMeshTexture(uint32_t meshIndex, uint32_t textureHandle, std::vector<uint32_t>* releasedHandles);
 
    void clean();
 
    ~MeshModel();
 private:
    std::vector<Mesh> meshList;
-   glm::mat4 model = glm::identity<glm::mat4>();
-   PushModel pushModel;
+   std::vector<uint32_t> textureHandles;
+
+   std::vector<ObjectData> instances; //dense, drawn in this order, a removal moves the last instance in the hole
+   std::vector<uint32_t> instanceIds; //id of each dense instance
+   std::vector<uint32_t> instanceIndices; //dense index of each id, UINT32_MAX for removed ids
+   std::vector<uint32_t> freeInstanceIds;
 };
\ No newline at end of file
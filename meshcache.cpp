@@ -0,0 +1,206 @@
+#include "meshcache.h"
+
+#include <cstdio>
+#include <cstring>
+
+struct MeshCacheHeader
+{
+   uint32_t magic = MeshCache::MAGIC;
+   uint32_t version = MeshCache::VERSION;
+   uint32_t settings = 0;
+   uint32_t materialCount = 0;
+   uint32_t meshCount = 0;
+   uint32_t vertexStride = 0;
+   SourceStamp sourceStamp;
+};
+
+struct MeshCacheEntry
+{
+   uint64_t vertexDataOffset = 0;
+   uint64_t indexDataOffset = 0;
+   uint32_t vertexCount = 0;
+   uint32_t indexCount = 0;
+   uint32_t indexSize = 0;
+   uint32_t materialIndex = 0;
+   glm::vec4 boundsOffset = {};
+   glm::vec4 boundsScale = {};
+};
+
+static uint64_t alignOffset(uint64_t offset)
+{
+   return (offset + 15) / 16 * 16;
+}
+
+bool MeshCache::open(const std::string& cachePath, const std::string& sourcePath, uint32_t settings)
+{
+   materialTextures.clear();
+   meshes.clear();
+
+   if (!file.open(cachePath) || file.getSize() < sizeof(MeshCacheHeader))
+   {
+      file.close();
+      return false;
+   }
+
+   MeshCacheHeader header;
+   memcpy(&header, file.getData(), sizeof(header));
+
+   bool valid = header.magic == MAGIC && header.version == VERSION && header.settings == settings;
+
+   //a cache without its source is still used, so cooked models can be shipped alone
+   if (valid)
+      valid = matchesSourceStamp(sourcePath, header.sourceStamp);
+
+   uint64_t offset = sizeof(MeshCacheHeader);
+   for (uint32_t i = 0; valid && i < header.materialCount; ++i)
+   {
+      uint32_t length = 0;
+      if (offset + sizeof(length) > file.getSize())
+      {
+         valid = false;
+         break;
+      }
+      memcpy(&length, file.getData() + offset, sizeof(length));
+      offset += sizeof(length);
+
+      if (offset + length > file.getSize())
+      {
+         valid = false;
+         break;
+      }
+      materialTextures.emplace_back(reinterpret_cast<const char*>(file.getData() + offset), length);
+      offset += (length + 3) / 4 * 4;
+   }
+
+   offset = alignOffset(offset);
+   if (valid && offset + sizeof(MeshCacheEntry) * header.meshCount > file.getSize())
+      valid = false;
+
+   for (uint32_t i = 0; valid && i < header.meshCount; ++i)
+   {
+      MeshCacheEntry entry;
+      memcpy(&entry, file.getData() + offset + sizeof(MeshCacheEntry) * i, sizeof(entry));
+
+      uint64_t vertexDataSize = static_cast<uint64_t>(entry.vertexCount) * header.vertexStride;
+      uint64_t indexDataSize = static_cast<uint64_t>(entry.indexCount) * entry.indexSize;
+      if (entry.vertexDataOffset + vertexDataSize > file.getSize() || entry.indexDataOffset + indexDataSize > file.getSize() ||
+         (entry.indexSize != sizeof(uint16_t) && entry.indexSize != sizeof(uint32_t)) || entry.materialIndex >= header.materialCount)
+      {
+         valid = false;
+         break;
+      }
+
+      CookedMeshView mesh;
+      mesh.vertexData = file.getData() + entry.vertexDataOffset;
+      mesh.indexData = file.getData() + entry.indexDataOffset;
+      mesh.vertexCount = entry.vertexCount;
+      mesh.indexCount = entry.indexCount;
+      mesh.indexSize = entry.indexSize;
+      mesh.materialIndex = entry.materialIndex;
+      mesh.bounds.offset = entry.boundsOffset;
+      mesh.bounds.scale = entry.boundsScale;
+      meshes.push_back(mesh);
+   }
+
+   if (!valid)
+   {
+      materialTextures.clear();
+      meshes.clear();
+      file.close();
+   }
+
+   return valid;
+}
+
+static void writePadding(FILE* file, uint64_t* offset, uint64_t alignedOffset)
+{
+   static const uint8_t zeros[16] = {};
+   fwrite(zeros, 1, static_cast<size_t>(alignedOffset - *offset), file);
+   *offset = alignedOffset;
+}
+
+bool MeshCache::write(const std::string& cachePath, const std::string& sourcePath, uint32_t settings,
+   const std::vector<std::string>& materialTextures, const std::vector<CookedMesh>& meshes)
+{
+   MeshCacheHeader header;
+   header.settings = settings;
+   header.materialCount = static_cast<uint32_t>(materialTextures.size());
+   header.meshCount = static_cast<uint32_t>(meshes.size());
+   for (const auto& mesh : meshes)
+      if (mesh.vertexCount > 0)
+         header.vertexStride = static_cast<uint32_t>(mesh.vertexData.size() / mesh.vertexCount);
+   if (!readSourceStamp(sourcePath, &header.sourceStamp))
+      return false;
+
+   //written to a temporary file first, a crash while cooking must not leave a cache that looks valid
+   std::string temporaryPath = cachePath + ".tmp";
+   FILE* file = fopen(temporaryPath.c_str(), "wb");
+   if (!file)
+      return false;
+
+   uint64_t offset = 0;
+   fwrite(&header, sizeof(header), 1, file);
+   offset += sizeof(header);
+
+   for (const auto& name : materialTextures)
+   {
+      uint32_t length = static_cast<uint32_t>(name.size());
+      fwrite(&length, sizeof(length), 1, file);
+      fwrite(name.data(), 1, length, file);
+      offset += sizeof(length) + length;
+      writePadding(file, &offset, (offset + 3) / 4 * 4);
+   }
+   writePadding(file, &offset, alignOffset(offset));
+
+   //the blobs follow the entry table, their offsets are known before anything is written
+   uint64_t blobOffset = offset + sizeof(MeshCacheEntry) * meshes.size();
+   for (const auto& mesh : meshes)
+   {
+      MeshCacheEntry entry;
+      entry.vertexDataOffset = alignOffset(blobOffset);
+      entry.indexDataOffset = alignOffset(entry.vertexDataOffset + mesh.vertexData.size());
+      entry.vertexCount = mesh.vertexCount;
+      entry.indexCount = mesh.indexCount;
+      entry.indexSize = mesh.indexSize;
+      entry.materialIndex = mesh.materialIndex;
+      entry.boundsOffset = mesh.bounds.offset;
+      entry.boundsScale = mesh.bounds.scale;
+      blobOffset = entry.indexDataOffset + mesh.indexData.size();
+
+      fwrite(&entry, sizeof(entry), 1, file);
+      offset += sizeof(entry);
+   }
+
+   for (const auto& mesh : meshes)
+   {
+      writePadding(file, &offset, alignOffset(offset));
+      fwrite(mesh.vertexData.data(), 1, mesh.vertexData.size(), file);
+      offset += mesh.vertexData.size();
+
+      writePadding(file, &offset, alignOffset(offset));
+      fwrite(mesh.indexData.data(), 1, mesh.indexData.size(), file);
+      offset += mesh.indexData.size();
+   }
+
+   bool failed = ferror(file) != 0;
+   fclose(file);
+
+   if (failed)
+   {
+      remove(temporaryPath.c_str());
+      return false;
+   }
+
+   remove(cachePath.c_str());
+   return rename(temporaryPath.c_str(), cachePath.c_str()) == 0;
+}
+
+const std::vector<std::string>& MeshCache::getMaterialTextures() const
+{
+   return materialTextures;
+}
+
+const std::vector<CookedMeshView>& MeshCache::getMeshes() const
+{
+   return meshes;
+}
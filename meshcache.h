@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "mesh.h"
+#include "utils.h"
+
+//a model cooked to the geometry pool layout, stored next to the source file so later loads skip the import
+//layout : MeshCacheHeader, material texture names, one MeshCacheEntry per mesh, then the 16 byte aligned vertex and index blobs
+class MeshCache
+{
+public:
+   static const uint32_t MAGIC = 0x434d4b56; //"VKMC"
+   static const uint32_t VERSION = 1;
+
+   MeshCache() = default;
+   MeshCache(const MeshCache&) = delete;
+   MeshCache& operator=(const MeshCache&) = delete;
+
+   //false when the cache is missing, was cooked with other settings or the source file changed since
+   bool open(const std::string& cachePath, const std::string& sourcePath, uint32_t settings);
+   static bool write(const std::string& cachePath, const std::string& sourcePath, uint32_t settings,
+      const std::vector<std::string>& materialTextures, const std::vector<CookedMesh>& meshes);
+
+   const std::vector<std::string>& getMaterialTextures() const;
+   //points in the mapped file, valid until the cache is destroyed
+   const std::vector<CookedMeshView>& getMeshes() const;
+
+private:
+   MappedFile file;
+   std::vector<std::string> materialTextures;
+   std::vector<CookedMeshView> meshes;
+};
@@ -0,0 +1,287 @@
+#include "meshoptimize.h"
+
+#include <algorithm>
+#include <cmath>
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+   VertexCacheStatistics out;
+   //no whole triangle to divide by
+   if (indices.size() < 3)
+      return out;
+
+   //a vertex is in the cache when it was loaded less than cacheSize misses ago
+   std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+   std::vector<bool> referenced(vertexCount, false);
+   uint32_t timestamp = cacheSize + 1;
+   uint32_t misses = 0;
+   uint32_t uniqueVertices = 0;
+
+   for (auto i : indices)
+   {
+      if (timestamp - cacheTimestamps[i] > cacheSize)
+      {
+         cacheTimestamps[i] = timestamp++;
+         ++misses;
+      }
+
+      if (!referenced[i])
+      {
+         referenced[i] = true;
+         ++uniqueVertices;
+      }
+   }
+
+   out.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+   out.atvr = static_cast<float>(misses) / static_cast<float>(uniqueVertices);
+   return out;
+}
+
+static const uint32_t FORSYTH_CACHE_SIZE = 32;
+
+static float forsythVertexScore(int32_t cachePosition, uint32_t remainingValence)
+{
+   if (remainingValence == 0)
+      return -1.0f;
+
+   float score = 0.0f;
+   if (cachePosition >= 0)
+   {
+      //the vertices of the last triangle get a fixed score so the next one does not just reuse the same edge
+      if (cachePosition < 3)
+         score = 0.75f;
+      else
+         score = std::pow(1.0f - static_cast<float>(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+   }
+
+   //vertices with few triangles left are finished first so they leave the cache for good
+   score += 2.0f / std::sqrt(static_cast<float>(remainingValence));
+   return score;
+}
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+   size_t triangleCount = indices.size() / 3;
+   if (triangleCount == 0)
+      return;
+
+   //the triangles of each vertex, the not yet emitted ones are the first remainingValence entries
+   std::vector<uint32_t> remainingValence(vertexCount, 0);
+   for (auto i : indices)
+      ++remainingValence[i];
+
+   std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+   for (size_t v = 0; v < vertexCount; ++v)
+      triangleOffsets[v + 1] = triangleOffsets[v] + remainingValence[v];
+
+   std::vector<uint32_t> adjacentTriangles(indices.size());
+   std::vector<uint32_t> fillOffsets(triangleOffsets.begin(), triangleOffsets.end() - 1);
+   for (size_t t = 0; t < triangleCount; ++t)
+      for (size_t j = 0; j < 3; ++j)
+         adjacentTriangles[fillOffsets[indices[t * 3 + j]]++] = static_cast<uint32_t>(t);
+
+   std::vector<int32_t> cachePositions(vertexCount, -1);
+   std::vector<float> vertexScores(vertexCount);
+   for (size_t v = 0; v < vertexCount; ++v)
+      vertexScores[v] = forsythVertexScore(-1, remainingValence[v]);
+
+   std::vector<float> triangleScores(triangleCount);
+   for (size_t t = 0; t < triangleCount; ++t)
+      triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+   std::vector<bool> emitted(triangleCount, false);
+   std::vector<uint32_t> cache;
+   std::vector<uint32_t> newCache;
+   cache.reserve(FORSYTH_CACHE_SIZE + 3);
+   newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+   std::vector<uint32_t> out;
+   out.reserve(indices.size());
+
+   size_t nextUnemitted = 0;
+   uint32_t bestTriangle = static_cast<uint32_t>(std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin());
+
+   while (out.size() < indices.size())
+   {
+      //nothing in the cache has triangles left, continue with the first remaining triangle
+      if (bestTriangle == UINT32_MAX)
+      {
+         while (emitted[nextUnemitted])
+            ++nextUnemitted;
+         bestTriangle = static_cast<uint32_t>(nextUnemitted);
+      }
+
+      const uint32_t* triangle = &indices[bestTriangle * 3];
+      emitted[bestTriangle] = true;
+
+      newCache.clear();
+      for (size_t j = 0; j < 3; ++j)
+      {
+         uint32_t v = triangle[j];
+         out.push_back(v);
+
+         uint32_t begin = triangleOffsets[v];
+         uint32_t end = begin + remainingValence[v];
+         for (uint32_t k = begin; k < end; ++k)
+         {
+            if (adjacentTriangles[k] == bestTriangle)
+            {
+               std::swap(adjacentTriangles[k], adjacentTriangles[end - 1]);
+               break;
+            }
+         }
+         --remainingValence[v];
+
+         if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+            newCache.push_back(v);
+      }
+
+      for (auto v : cache)
+         if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+            newCache.push_back(v);
+
+      //the entries past the cache size were pushed out, their scores drop with the rest
+      for (size_t i = 0; i < newCache.size(); ++i)
+      {
+         uint32_t v = newCache[i];
+         cachePositions[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+         vertexScores[v] = forsythVertexScore(cachePositions[v], remainingValence[v]);
+      }
+
+      bestTriangle = UINT32_MAX;
+      float bestScore = -1.0f;
+      for (auto v : newCache)
+      {
+         uint32_t begin = triangleOffsets[v];
+         uint32_t end = begin + remainingValence[v];
+         for (uint32_t k = begin; k < end; ++k)
+         {
+            uint32_t t = adjacentTriangles[k];
+            float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+            triangleScores[t] = score;
+
+            if (score > bestScore)
+            {
+               bestScore = score;
+               bestTriangle = t;
+            }
+         }
+      }
+
+      if (newCache.size() > FORSYTH_CACHE_SIZE)
+         newCache.resize(FORSYTH_CACHE_SIZE);
+      cache.swap(newCache);
+   }
+
+   indices.swap(out);
+}
+
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, uint32_t cacheSize)
+{
+   size_t triangleCount = indices.size() / 3;
+   if (triangleCount == 0)
+      return;
+
+   //a cluster ends where the cache simulation misses on all three vertices, moving whole clusters keeps the cache hits inside them
+   std::vector<uint32_t> clusterStarts;
+   std::vector<uint32_t> cacheTimestamps(vertices.size(), 0);
+   uint32_t timestamp = cacheSize + 1;
+   for (size_t t = 0; t < triangleCount; ++t)
+   {
+      uint32_t misses = 0;
+      for (size_t j = 0; j < 3; ++j)
+      {
+         uint32_t v = indices[t * 3 + j];
+         if (timestamp - cacheTimestamps[v] > cacheSize)
+         {
+            cacheTimestamps[v] = timestamp++;
+            ++misses;
+         }
+      }
+
+      if (t == 0 || misses == 3)
+         clusterStarts.push_back(static_cast<uint32_t>(t));
+   }
+   clusterStarts.push_back(static_cast<uint32_t>(triangleCount));
+
+   size_t clusterCount = clusterStarts.size() - 1;
+   if (clusterCount < 2)
+      return;
+
+   struct Cluster
+   {
+      glm::vec3 centroid = {};
+      glm::vec3 normal = {};
+      float area = 0.0f;
+      uint32_t index = 0;
+      float sortKey = 0.0f;
+   };
+
+   std::vector<Cluster> clusters(clusterCount);
+   glm::vec3 meshCentroid = {};
+   float meshArea = 0.0f;
+
+   for (size_t c = 0; c < clusterCount; ++c)
+   {
+      Cluster& cluster = clusters[c];
+      cluster.index = static_cast<uint32_t>(c);
+
+      for (uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+      {
+         const glm::vec3& a = vertices[indices[t * 3]].position;
+         const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+         const glm::vec3& d = vertices[indices[t * 3 + 2]].position;
+
+         glm::vec3 normal = glm::cross(b - a, d - a);
+         float area = glm::length(normal);
+
+         cluster.centroid += (a + b + d) * (area / 3.0f);
+         cluster.normal += normal;
+         cluster.area += area;
+      }
+
+      meshCentroid += cluster.centroid;
+      meshArea += cluster.area;
+
+      if (cluster.area > 0.0f)
+         cluster.centroid /= cluster.area;
+   }
+
+   if (meshArea > 0.0f)
+      meshCentroid /= meshArea;
+
+   //clusters far from the center that face away from it are likely to occlude the others
+   for (auto& cluster : clusters)
+   {
+      float normalLength = glm::length(cluster.normal);
+      cluster.sortKey = normalLength > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / normalLength) : 0.0f;
+   }
+
+   std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+   std::vector<uint32_t> out;
+   out.reserve(indices.size());
+   for (const auto& cluster : clusters)
+      out.insert(out.end(), indices.begin() + clusterStarts[cluster.index] * 3, indices.begin() + clusterStarts[cluster.index + 1] * 3);
+
+   indices.swap(out);
+}
+
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+   std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+   std::vector<Vertex> out;
+   out.reserve(vertices.size());
+
+   for (auto& i : indices)
+   {
+      if (remap[i] == UINT32_MAX)
+      {
+         remap[i] = static_cast<uint32_t>(out.size());
+         out.push_back(vertices[i]);
+      }
+      i = remap[i];
+   }
+
+   vertices.swap(out);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "mesh.h"
+
+struct VertexCacheStatistics
+{
+   float acmr = 0.0f; //vertex shader invocations per triangle, 0.5 is the best case for regular grids, 3 the worst
+   float atvr = 0.0f; //vertex shader invocations per referenced vertex, 1 is the best case
+};
+
+//simulates a fifo post transform cache of cacheSize entries
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = 16);
+
+//reorders the triangles for the post transform cache, Tom Forsyth's linear speed algorithm
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+//moves the clusters found by optimizeVertexCache so the outward facing ones are drawn first, the order inside a cluster is kept
+void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, uint32_t cacheSize = 16);
+//orders the vertices by first use and drops the unreferenced ones, the indices are remapped
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
@@ -0,0 +1,125 @@
+#include "pipelinecache.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+struct PipelineCacheHeader
+{
+   uint32_t magic = PipelineCache::MAGIC;
+   uint32_t version = PipelineCache::VERSION;
+   uint64_t dataSize = 0;
+   uint64_t dataHash = 0;
+};
+
+void PipelineCache::init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& directory)
+{
+   this->logicalDevice = logicalDevice;
+
+   VkPhysicalDeviceProperties properties = {};
+   vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+   char key[128] = {};
+   int keyLength = snprintf(key, sizeof(key), "pipelines_%04x_%04x_%08x_", properties.vendorID, properties.deviceID, properties.driverVersion);
+   for (uint32_t i = 0; i < VK_UUID_SIZE; ++i)
+      keyLength += snprintf(key + keyLength, sizeof(key) - keyLength, "%02x", properties.pipelineCacheUUID[i]);
+   filePath = directory + key + ".pipelinecache";
+
+   //a truncated or damaged file is dropped here, some drivers do not survive bad initial data
+   MappedFile file;
+   const void* initialData = nullptr;
+   size_t initialDataSize = 0;
+   if (file.open(filePath) && file.getSize() >= sizeof(PipelineCacheHeader))
+   {
+      PipelineCacheHeader header;
+      memcpy(&header, file.getData(), sizeof(header));
+
+      const uint8_t* data = file.getData() + sizeof(PipelineCacheHeader);
+      if (header.magic == MAGIC && header.version == VERSION && header.dataSize == file.getSize() - sizeof(PipelineCacheHeader) &&
+         header.dataHash == hashData(data, header.dataSize))
+      {
+         initialData = data;
+         initialDataSize = static_cast<size_t>(header.dataSize);
+      }
+   }
+
+   VkPipelineCacheCreateInfo createInfo = {};
+   createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+   createInfo.initialDataSize = initialDataSize;
+   createInfo.pInitialData = initialData;
+
+   //the driver can still refuse data that passed the checks above
+   if (initialDataSize == 0 || VK_SUCCESS != vkCreatePipelineCache(logicalDevice, &createInfo, nullptr, &cache))
+   {
+      createInfo.initialDataSize = 0;
+      createInfo.pInitialData = nullptr;
+      if (VK_SUCCESS != vkCreatePipelineCache(logicalDevice, &createInfo, nullptr, &cache))
+         throw std::runtime_error("Unable to create the pipeline cache");
+   }
+}
+
+void PipelineCache::cleanup()
+{
+   if (cache == VK_NULL_HANDLE)
+      return;
+
+   save();
+   vkDestroyPipelineCache(logicalDevice, cache, nullptr);
+   cache = VK_NULL_HANDLE;
+}
+
+PipelineCache::~PipelineCache()
+{
+   cleanup();
+}
+
+bool PipelineCache::save() const
+{
+   size_t dataSize = getDataSize();
+   if (dataSize == 0)
+      return false;
+
+   std::vector<uint8_t> data(dataSize);
+   if (VK_SUCCESS != vkGetPipelineCacheData(logicalDevice, cache, &dataSize, data.data()))
+      return false;
+
+   PipelineCacheHeader header;
+   header.dataSize = dataSize;
+   header.dataHash = hashData(data.data(), dataSize);
+
+   //written to a temporary file first, like the mesh cache
+   std::string temporaryPath = filePath + ".tmp";
+   FILE* file = fopen(temporaryPath.c_str(), "wb");
+   if (!file)
+      return false;
+
+   fwrite(&header, sizeof(header), 1, file);
+   fwrite(data.data(), 1, dataSize, file);
+
+   bool failed = ferror(file) != 0;
+   fclose(file);
+
+   if (failed)
+   {
+      remove(temporaryPath.c_str());
+      return false;
+   }
+
+   remove(filePath.c_str());
+   return rename(temporaryPath.c_str(), filePath.c_str()) == 0;
+}
+
+VkPipelineCache PipelineCache::get() const
+{
+   return cache;
+}
+
+size_t PipelineCache::getDataSize() const
+{
+   size_t dataSize = 0;
+   if (cache == VK_NULL_HANDLE || VK_SUCCESS != vkGetPipelineCacheData(logicalDevice, cache, &dataSize, nullptr))
+      return 0;
+   return dataSize;
+}
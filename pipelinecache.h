@@ -0,0 +1,35 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <cstdint>
+
+//the driver pipeline cache, loaded from disk at init and written back when it grows
+//the file name holds the vendor, device, driver version and cache uuid so the data of another gpu or driver is never handed to the driver
+class PipelineCache
+{
+public:
+   static const uint32_t MAGIC = 0x43504b56; //"VKPC"
+   static const uint32_t VERSION = 1;
+
+   PipelineCache() = default;
+   PipelineCache(const PipelineCache&) = delete;
+   PipelineCache& operator=(const PipelineCache&) = delete;
+
+   //starts empty when there is no file for this device or it is damaged
+   void init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& directory = "");
+   //saves before destroying the cache
+   void cleanup();
+
+   bool save() const;
+
+   VkPipelineCache get() const;
+   //grows when the driver adds pipelines that were not in the cache
+   size_t getDataSize() const;
+
+   ~PipelineCache();
+
+private:
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   VkPipelineCache cache = VK_NULL_HANDLE;
+   std::string filePath;
+};
@@ -0,0 +1,102 @@
+#include "ringbuffer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void FrameRingBuffer::init(DeviceMemoryAllocator* allocator, VkDevice logicalDevice, VkBufferUsageFlags usage, VkDeviceSize alignment, uint32_t frameCount, VkDeviceSize frameSize)
+{
+   this->allocator = allocator;
+   this->logicalDevice = logicalDevice;
+   this->alignment = std::max<VkDeviceSize>(alignment, 1);
+   this->frameCount = frameCount;
+   this->frameSize = alignedSize(frameSize);
+
+   //coherent memory is preferred so flush() has nothing to do, but any host visible type works
+   VkBufferCreateInfo bufferCreateInfo = {};
+   bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+   bufferCreateInfo.size = this->frameSize * frameCount;
+   bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+   bufferCreateInfo.usage = usage;
+
+   if (VK_SUCCESS != vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer))
+      throw std::runtime_error("Unable to create ring buffer");
+
+   VkMemoryRequirements memoryRequierments = {};
+   vkGetBufferMemoryRequirements(logicalDevice, buffer, &memoryRequierments);
+
+   memory = allocator->allocate(memoryRequierments, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, AllocationKind::linear, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+   if (VK_SUCCESS != vkBindBufferMemory(logicalDevice, buffer, memory.memory, memory.offset))
+      throw std::runtime_error("Unable to bind ring buffer memory");
+
+   currentFrame = 0;
+   head = 0;
+}
+
+void FrameRingBuffer::cleanup()
+{
+   if (allocator)
+      destroyBuffer(*allocator, logicalDevice, &buffer, &memory);
+
+   frameCount = 0;
+   frameSize = 0;
+   head = 0;
+}
+
+FrameRingBuffer::~FrameRingBuffer()
+{
+   cleanup();
+}
+
+void FrameRingBuffer::beginFrame(uint32_t frame)
+{
+   if (frame >= frameCount)
+      throw std::runtime_error("Ring buffer frame out of range");
+
+   currentFrame = frame;
+   head = 0;
+}
+
+VkDeviceSize FrameRingBuffer::allocate(VkDeviceSize size, void** data)
+{
+   VkDeviceSize allocationSize = alignedSize(size);
+   if (head + allocationSize > frameSize)
+      throw std::runtime_error("Ring buffer frame partition is full");
+
+   VkDeviceSize offset = getFrameOffset(currentFrame) + head;
+   head += allocationSize;
+
+   *data = static_cast<char*>(memory.mappedData) + offset;
+   return offset;
+}
+
+void FrameRingBuffer::flush()
+{
+   allocator->flush(memory, getFrameOffset(currentFrame), head);
+}
+
+VkBuffer FrameRingBuffer::getBuffer() const
+{
+   return buffer;
+}
+
+VkDeviceSize FrameRingBuffer::getFrameOffset(uint32_t frame) const
+{
+   return frameSize * frame;
+}
+
+VkDeviceSize FrameRingBuffer::getFrameSize() const
+{
+   return frameSize;
+}
+
+uint32_t FrameRingBuffer::getFrameCount() const
+{
+   return frameCount;
+}
+
+VkDeviceSize FrameRingBuffer::alignedSize(VkDeviceSize size) const
+{
+   return (size + alignment - 1) / alignment * alignment;
+}
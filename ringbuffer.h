@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstring>
+
+#include "allocator.h"
+
+//one persistently mapped buffer split in a partition per frame, the data of a frame is bump allocated from its partition
+class FrameRingBuffer
+{
+public:
+   FrameRingBuffer() = default;
+   FrameRingBuffer(const FrameRingBuffer&) = delete;
+   FrameRingBuffer& operator=(const FrameRingBuffer&) = delete;
+
+   void init(DeviceMemoryAllocator* allocator, VkDevice logicalDevice, VkBufferUsageFlags usage, VkDeviceSize alignment, uint32_t frameCount, VkDeviceSize frameSize);
+   void cleanup();
+
+   void beginFrame(uint32_t frame);
+   //returns the offset from the start of the buffer, data points to the mapped memory at that offset
+   VkDeviceSize allocate(VkDeviceSize size, void** data);
+   template<typename T>
+   VkDeviceSize push(const T& value);
+   //makes the data written since beginFrame visible to the device
+   void flush();
+
+   VkBuffer getBuffer() const;
+   VkDeviceSize getFrameOffset(uint32_t frame) const;
+   VkDeviceSize getFrameSize() const;
+   uint32_t getFrameCount() const;
+   VkDeviceSize alignedSize(VkDeviceSize size) const;
+
+   ~FrameRingBuffer();
+
+private:
+   DeviceMemoryAllocator* allocator = nullptr;
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   VkBuffer buffer = VK_NULL_HANDLE;
+   MemoryAllocation memory;
+   VkDeviceSize alignment = 1;
+   VkDeviceSize frameSize = 0;
+   uint32_t frameCount = 0;
+   uint32_t currentFrame = 0;
+   VkDeviceSize head = 0;
+};
+
+template<typename T>
+inline VkDeviceSize FrameRingBuffer::push(const T& value)
+{
+   void* data = nullptr;
+   VkDeviceSize offset = allocate(sizeof(T), &data);
+   memcpy(data, &value, sizeof(T));
+   return offset;
+}
@@ -0,0 +1,84 @@
+#include "shaderlibrary.h"
+#include "utils.h"
+
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+void ShaderLibrary::init(VkDevice logicalDevice)
+{
+   this->logicalDevice = logicalDevice;
+}
+
+void ShaderLibrary::cleanup()
+{
+   for (auto& entry : entries)
+      vkDestroyShaderModule(logicalDevice, entry.second.module, nullptr);
+   entries.clear();
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+   cleanup();
+}
+
+VkShaderModule ShaderLibrary::get(const std::string& name)
+{
+   auto found = entries.find(name);
+   if (found != entries.end() && !found->second.stale)
+      return found->second.module;
+
+   std::vector<char> code = readFile(name.c_str());
+
+   //the code is read as 32 bit words, a file that does not start with the magic number is not SPIR-V
+   uint32_t magic = 0;
+   if (code.size() < sizeof(magic) || code.size() % sizeof(uint32_t) != 0)
+      throw std::runtime_error("Invalid shader file : " + name);
+   memcpy(&magic, code.data(), sizeof(magic));
+   if (magic != SPIRV_MAGIC)
+      throw std::runtime_error("Invalid shader file : " + name);
+
+   uint64_t hash = hashData(code.data(), code.size());
+   if (found != entries.end())
+   {
+      found->second.stale = false;
+      if (found->second.hash == hash)
+         return found->second.module;
+   }
+
+   VkShaderModuleCreateInfo createInfo = {};
+   createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+   createInfo.codeSize = code.size();
+   createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+   VkShaderModule module = VK_NULL_HANDLE;
+   if (VK_SUCCESS != vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &module))
+      throw std::runtime_error("Unable to create shader module");
+
+   Entry& entry = entries[name];
+   if (entry.module != VK_NULL_HANDLE)
+      vkDestroyShaderModule(logicalDevice, entry.module, nullptr);
+
+   entry.module = module;
+   entry.hash = hash;
+   return module;
+}
+
+uint64_t ShaderLibrary::getHash(const std::string& name) const
+{
+   auto found = entries.find(name);
+   return found == entries.end() ? 0 : found->second.hash;
+}
+
+void ShaderLibrary::invalidate(const std::string& name)
+{
+   auto found = entries.find(name);
+   if (found != entries.end())
+      found->second.stale = true;
+}
+
+void ShaderLibrary::invalidateAll()
+{
+   for (auto& entry : entries)
+      entry.second.stale = true;
+}
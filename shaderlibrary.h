@@ -0,0 +1,42 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+//the shader modules by file name, each SPIR-V file is read and checked once so rebuilding pipelines does no file io
+class ShaderLibrary
+{
+public:
+   static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+   ShaderLibrary() = default;
+   ShaderLibrary(const ShaderLibrary&) = delete;
+   ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+   void init(VkDevice logicalDevice);
+   void cleanup();
+
+   //throws when the file is missing or is not SPIR-V
+   VkShaderModule get(const std::string& name);
+   //the hash of the code behind the module, 0 when the shader was never loaded
+   uint64_t getHash(const std::string& name) const;
+
+   //the next get reads the file again, the module is only replaced when the code changed
+   //a replaced module is destroyed, so no pipeline may be in creation with it
+   void invalidate(const std::string& name);
+   void invalidateAll();
+
+   ~ShaderLibrary();
+
+private:
+   struct Entry
+   {
+      VkShaderModule module = VK_NULL_HANDLE;
+      uint64_t hash = 0;
+      bool stale = false;
+   };
+
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   std::unordered_map<std::string, Entry> entries;
+};
@@ -0,0 +1,21 @@
+#version 450 // GLSL 4.5
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec3 inColor;
+layout(location = 1) in vec2 inUV;
+
+layout(location = 0) out vec4 outColor;
+
+//every loaded texture, indexed by its handle
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+//the vertex stage owns the mesh bounds in the first 32 bytes
+layout(push_constant) uniform PushTexture
+{
+   layout(offset = 32) uint textureIndex;
+} pushTexture;
+
+void main()
+{
+   outColor = vec4(inColor, 1.0) * texture(textures[pushTexture.textureIndex], inUV);
+}
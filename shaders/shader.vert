@@ -1,31 +1,42 @@
 #version 450 // GLSL 4.5
 
-layout(location = 0) in vec3 position;
+layout(location = 0) in vec3 position; //R32G32B32_SFLOAT or R16G16B16A16_UNORM relative to the mesh bounds
 layout(location = 1) in vec3 color;
 layout(location = 2) in vec2 uv;
 
+//offset 0 and scale 1 for full vertices
+layout(push_constant) uniform PushMeshBounds
+{
+   vec4 offset;
+   vec4 scale;
+} meshBounds;
+
 layout(set = 0, binding = 0) uniform UboViewProjection
 {
    mat4 projection;
    mat4 view;
 } uboViewProjection;
 
-layout(set = 0, binding = 1) uniform Model
+struct Object
 {
    mat4 model;
-} model;
+   vec4 color;
+};
 
-layout(push_constant) uniform PushColor
+//one record per instance, the draw passes the first instance of the model as firstInstance
+layout(std430, set = 0, binding = 1) readonly buffer Objects
 {
-   vec3 color;
-} pushColor;
+   Object data[];
+} objects;
 
 layout(location = 0) out vec3 outColor;
 layout(location = 1) out vec2 outUV;
 
 void main()
 {
-   gl_Position = uboViewProjection.projection * uboViewProjection.view * model.model * vec4(position, 1.0);
-   outColor = color * pushColor.color;
+   Object object = objects.data[gl_InstanceIndex];
+   vec3 meshPosition = meshBounds.offset.xyz + position * meshBounds.scale.xyz;
+   gl_Position = uboViewProjection.projection * uboViewProjection.view * object.model * vec4(meshPosition, 1.0);
+   outColor = color * object.color.rgb;
    outUV = uv;
 }
\ No newline at end of file
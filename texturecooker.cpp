@@ -0,0 +1,296 @@
+#include "texturecooker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+static const char* SOURCE_STAMP_KEY = "VkCourseSourceStamp";
+
+static uint16_t packColor565(const float* color)
+{
+   uint32_t r = static_cast<uint32_t>(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+   uint32_t g = static_cast<uint32_t>(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+   uint32_t b = static_cast<uint32_t>(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+   return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor565(uint16_t packed, int32_t* color)
+{
+   int32_t r = (packed >> 11) & 31;
+   int32_t g = (packed >> 5) & 63;
+   int32_t b = packed & 31;
+   color[0] = (r << 3) | (r >> 2);
+   color[1] = (g << 2) | (g >> 4);
+   color[2] = (b << 3) | (b >> 2);
+}
+
+void compressBC1Block(const uint8_t* texels, uint8_t* out)
+{
+   //the endpoints are the extremes of the colors along their principal axis
+   float mean[3] = {};
+   for (uint32_t i = 0; i < 16; ++i)
+      for (uint32_t c = 0; c < 3; ++c)
+         mean[c] += texels[i * 4 + c] / 16.0f;
+
+   float covariance[6] = {};
+   for (uint32_t i = 0; i < 16; ++i)
+   {
+      float r = texels[i * 4] - mean[0];
+      float g = texels[i * 4 + 1] - mean[1];
+      float b = texels[i * 4 + 2] - mean[2];
+      covariance[0] += r * r;
+      covariance[1] += r * g;
+      covariance[2] += r * b;
+      covariance[3] += g * g;
+      covariance[4] += g * b;
+      covariance[5] += b * b;
+   }
+
+   //starting from the row of the strongest channel, a fixed start can be orthogonal to the axis
+   float axis[3] = { covariance[0], covariance[1], covariance[2] };
+   if (covariance[3] > covariance[0] && covariance[3] >= covariance[5])
+   {
+      axis[0] = covariance[1];
+      axis[1] = covariance[3];
+      axis[2] = covariance[4];
+   }
+   else if (covariance[5] > covariance[0] && covariance[5] > covariance[3])
+   {
+      axis[0] = covariance[2];
+      axis[1] = covariance[4];
+      axis[2] = covariance[5];
+   }
+
+   for (uint32_t iteration = 0; iteration < 8; ++iteration)
+   {
+      float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+      float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+      float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+      float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+      if (length <= 0.0f)
+         break;
+
+      axis[0] = x / length;
+      axis[1] = y / length;
+      axis[2] = z / length;
+   }
+
+   //a flat block has no axis, both endpoints end up at the mean
+   float axisLength = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+   if (axisLength <= 0.0f)
+   {
+      axis[0] = axis[1] = axis[2] = 1.0f;
+      axisLength = 3.0f;
+   }
+
+   float minProjection = 0.0f;
+   float maxProjection = 0.0f;
+   for (uint32_t i = 0; i < 16; ++i)
+   {
+      float projection = ((texels[i * 4] - mean[0]) * axis[0] + (texels[i * 4 + 1] - mean[1]) * axis[1] + (texels[i * 4 + 2] - mean[2]) * axis[2]) / axisLength;
+      minProjection = std::min(minProjection, projection);
+      maxProjection = std::max(maxProjection, projection);
+   }
+
+   float maxColor[3];
+   float minColor[3];
+   for (uint32_t c = 0; c < 3; ++c)
+   {
+      maxColor[c] = mean[c] + axis[c] * maxProjection;
+      minColor[c] = mean[c] + axis[c] * minProjection;
+   }
+
+   uint16_t color0 = packColor565(maxColor);
+   uint16_t color1 = packColor565(minColor);
+   if (color0 < color1)
+      std::swap(color0, color1);
+
+   //color0 > color1 selects the four color mode, equal endpoints only use index 0
+   int32_t palette[4][3];
+   unpackColor565(color0, palette[0]);
+   unpackColor565(color1, palette[1]);
+   for (uint32_t c = 0; c < 3; ++c)
+   {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+   }
+
+   uint32_t indices = 0;
+   if (color0 != color1)
+   {
+      for (uint32_t i = 0; i < 16; ++i)
+      {
+         uint32_t bestIndex = 0;
+         int32_t bestDistance = INT32_MAX;
+         for (uint32_t p = 0; p < 4; ++p)
+         {
+            int32_t r = texels[i * 4] - palette[p][0];
+            int32_t g = texels[i * 4 + 1] - palette[p][1];
+            int32_t b = texels[i * 4 + 2] - palette[p][2];
+            int32_t distance = r * r + g * g + b * b;
+            if (distance < bestDistance)
+            {
+               bestDistance = distance;
+               bestIndex = p;
+            }
+         }
+         indices |= bestIndex << (i * 2);
+      }
+   }
+
+   memcpy(out, &color0, sizeof(color0));
+   memcpy(out + 2, &color1, sizeof(color1));
+   memcpy(out + 4, &indices, sizeof(indices));
+}
+
+static void compressAlphaBlock(const uint8_t* texels, uint8_t* out)
+{
+   uint8_t alpha0 = 0;
+   uint8_t alpha1 = 255;
+   for (uint32_t i = 0; i < 16; ++i)
+   {
+      alpha0 = std::max(alpha0, texels[i * 4 + 3]);
+      alpha1 = std::min(alpha1, texels[i * 4 + 3]);
+   }
+
+   //alpha0 > alpha1 selects the mode with six interpolated values between them
+   uint64_t indices = 0;
+   if (alpha0 != alpha1)
+   {
+      int32_t palette[8] = { alpha0, alpha1 };
+      for (int32_t p = 1; p < 7; ++p)
+         palette[p + 1] = ((7 - p) * alpha0 + p * alpha1 + 3) / 7;
+
+      for (uint32_t i = 0; i < 16; ++i)
+      {
+         uint64_t bestIndex = 0;
+         int32_t bestDistance = INT32_MAX;
+         for (uint32_t p = 0; p < 8; ++p)
+         {
+            int32_t distance = std::abs(texels[i * 4 + 3] - palette[p]);
+            if (distance < bestDistance)
+            {
+               bestDistance = distance;
+               bestIndex = p;
+            }
+         }
+         indices |= bestIndex << (i * 3);
+      }
+   }
+
+   out[0] = alpha0;
+   out[1] = alpha1;
+   for (uint32_t i = 0; i < 6; ++i)
+      out[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+}
+
+void compressBC3Block(const uint8_t* texels, uint8_t* out)
+{
+   compressAlphaBlock(texels, out);
+   compressBC1Block(texels, out + 8);
+}
+
+std::vector<uint8_t> compressImage(const uint8_t* rgba, uint32_t width, uint32_t height, BlockCompression compression)
+{
+   uint32_t blockSize = compression == BlockCompression::bc1 ? 8 : 16;
+   uint32_t blocksX = (width + 3) / 4;
+   uint32_t blocksY = (height + 3) / 4;
+
+   std::vector<uint8_t> out(static_cast<size_t>(blocksX) * blocksY * blockSize);
+   uint8_t texels[64];
+   for (uint32_t by = 0; by < blocksY; ++by)
+   {
+      for (uint32_t bx = 0; bx < blocksX; ++bx)
+      {
+         for (uint32_t y = 0; y < 4; ++y)
+         {
+            uint32_t sourceY = std::min(by * 4 + y, height - 1);
+            for (uint32_t x = 0; x < 4; ++x)
+            {
+               uint32_t sourceX = std::min(bx * 4 + x, width - 1);
+               memcpy(texels + (y * 4 + x) * 4, rgba + (static_cast<size_t>(sourceY) * width + sourceX) * 4, 4);
+            }
+         }
+
+         uint8_t* block = out.data() + (static_cast<size_t>(by) * blocksX + bx) * blockSize;
+         if (compression == BlockCompression::bc1)
+            compressBC1Block(texels, block);
+         else
+            compressBC3Block(texels, block);
+      }
+   }
+
+   return out;
+}
+
+std::string getCookedTexturePath(const std::string& sourcePath)
+{
+   return sourcePath + ".ktx2";
+}
+
+bool cookTexture(const std::string& sourcePath, const std::string& cookedPath)
+{
+   Image image = readImage(sourcePath.c_str(), ReadImageChannels::rgb_alpha);
+   if (image.data.empty())
+      return false;
+
+   SourceStamp stamp;
+   if (!readSourceStamp(sourcePath, &stamp))
+      return false;
+
+   BlockCompression compression = BlockCompression::bc1;
+   for (size_t i = 3; i < image.data.size(); i += 4)
+   {
+      if (static_cast<uint8_t>(image.data[i]) != 255)
+      {
+         compression = BlockCompression::bc3;
+         break;
+      }
+   }
+
+   uint32_t mipLevels = getMipLevelCount(image.width, image.height);
+   std::vector<VkDeviceSize> levelOffsets;
+   std::vector<char> mipChain = buildMipChain(image, static_cast<uint32_t>(ReadImageChannels::rgb_alpha), mipLevels, &levelOffsets);
+
+   std::vector<std::vector<uint8_t>> levels;
+   for (uint32_t i = 0; i < mipLevels; ++i)
+   {
+      const uint8_t* level = reinterpret_cast<const uint8_t*>(mipChain.data() + levelOffsets[i]);
+      levels.push_back(compressImage(level, std::max(image.width >> i, 1u), std::max(image.height >> i, 1u), compression));
+   }
+
+   std::vector<std::pair<std::string, std::vector<uint8_t>>> keyValues;
+   const uint8_t* stampBytes = reinterpret_cast<const uint8_t*>(&stamp);
+   keyValues.emplace_back(SOURCE_STAMP_KEY, std::vector<uint8_t>(stampBytes, stampBytes + sizeof(stamp)));
+
+   if (compression == BlockCompression::bc1)
+      return Ktx2Texture::write(cookedPath, VK_FORMAT_BC1_RGB_UNORM_BLOCK, image.width, image.height, 8, levels, keyValues);
+   return Ktx2Texture::write(cookedPath, VK_FORMAT_BC3_UNORM_BLOCK, image.width, image.height, 16, levels, keyValues);
+}
+
+bool openCookedTexture(const std::string& cookedPath, const std::string& sourcePath, Ktx2Texture* texture)
+{
+   if (!texture->open(cookedPath))
+      return false;
+
+   const uint8_t* value = nullptr;
+   uint32_t valueSize = 0;
+   if (!texture->findKeyValue(SOURCE_STAMP_KEY, &value, &valueSize))
+      return true;
+
+   SourceStamp stamp;
+   if (valueSize != sizeof(stamp))
+   {
+      texture->close();
+      return false;
+   }
+
+   memcpy(&stamp, value, sizeof(stamp));
+   if (!matchesSourceStamp(sourcePath, stamp))
+   {
+      texture->close();
+      return false;
+   }
+
+   return true;
+}
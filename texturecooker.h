@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "ktx2.h"
+
+enum class BlockCompression
+{
+   bc1, //opaque rgb, 8 bytes per 4x4 block
+   bc3  //rgb with interpolated alpha, 16 bytes per 4x4 block
+};
+
+//texels is a 4x4 block of rgba8 values, row by row
+void compressBC1Block(const uint8_t* texels, uint8_t* out);
+void compressBC3Block(const uint8_t* texels, uint8_t* out);
+//the blocks past the edge of an image that is not a multiple of 4 repeat the last row and column
+std::vector<uint8_t> compressImage(const uint8_t* rgba, uint32_t width, uint32_t height, BlockCompression compression);
+
+//cooked textures are stored next to their source
+std::string getCookedTexturePath(const std::string& sourcePath);
+//writes a KTX2 file with the full mip chain, bc3 when the image has any transparency and bc1 otherwise
+bool cookTexture(const std::string& sourcePath, const std::string& cookedPath);
+//false when the file is missing or was cooked from another version of the source, files from other tools are accepted as they are
+bool openCookedTexture(const std::string& cookedPath, const std::string& sourcePath, Ktx2Texture* texture);
@@ -0,0 +1,108 @@
+#include "textureregistry.h"
+
+std::string TextureRegistry::normalizePath(const std::string& path)
+{
+   std::string out;
+   out.reserve(path.size());
+
+   for (size_t i = 0; i < path.size(); ++i)
+   {
+      char c = path[i] == '\\' ? '/' : path[i];
+
+      //repeated separators and "./" segments do not change the file
+      if (c == '/' && !out.empty() && out.back() == '/')
+         continue;
+      if (c == '.' && (out.empty() || out.back() == '/') && i + 1 < path.size() && (path[i + 1] == '/' || path[i + 1] == '\\'))
+      {
+         ++i;
+         continue;
+      }
+
+      out.push_back(c);
+   }
+
+   return out;
+}
+
+uint32_t TextureRegistry::findByPath(const std::string& path) const
+{
+   auto found = handlesByPath.find(path);
+   return found == handlesByPath.end() ? INVALID_HANDLE : found->second;
+}
+
+uint32_t TextureRegistry::findByContent(uint64_t contentHash) const
+{
+   auto found = handlesByContent.find(contentHash);
+   return found == handlesByContent.end() ? INVALID_HANDLE : found->second;
+}
+
+uint32_t TextureRegistry::add(const std::string& path, uint64_t contentHash)
+{
+   uint32_t handle = 0;
+   if (!freeHandles.empty())
+   {
+      handle = freeHandles.back();
+      freeHandles.pop_back();
+   }
+   else
+   {
+      handle = static_cast<uint32_t>(entries.size());
+      entries.emplace_back();
+   }
+
+   Entry& entry = entries[handle];
+   entry.references = 1;
+   entry.contentHash = contentHash;
+   entry.paths.push_back(path);
+
+   handlesByPath[path] = handle;
+   handlesByContent.emplace(contentHash, handle);
+   return handle;
+}
+
+void TextureRegistry::addAlias(uint32_t handle, const std::string& path)
+{
+   if (handlesByPath.emplace(path, handle).second)
+      entries[handle].paths.push_back(path);
+}
+
+void TextureRegistry::acquire(uint32_t handle)
+{
+   ++entries[handle].references;
+}
+
+bool TextureRegistry::release(uint32_t handle)
+{
+   Entry& entry = entries[handle];
+   if (entry.references == 0 || --entry.references > 0)
+      return false;
+
+   for (const auto& path : entry.paths)
+      handlesByPath.erase(path);
+
+   auto content = handlesByContent.find(entry.contentHash);
+   if (content != handlesByContent.end() && content->second == handle)
+      handlesByContent.erase(content);
+
+   entry = Entry();
+   freeHandles.push_back(handle);
+   return true;
+}
+
+uint32_t TextureRegistry::getReferenceCount(uint32_t handle) const
+{
+   return handle < entries.size() ? entries[handle].references : 0;
+}
+
+uint32_t TextureRegistry::getSlotCount() const
+{
+   return static_cast<uint32_t>(entries.size());
+}
+
+void TextureRegistry::clear()
+{
+   entries.clear();
+   freeHandles.clear();
+   handlesByPath.clear();
+   handlesByContent.clear();
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+//finds loaded textures by path or by the hash of their contents, the handles are slots that stay valid until the last reference is released
+//only the bookkeeping lives here, the renderer keeps the gpu objects of each slot
+class TextureRegistry
+{
+public:
+   static const uint32_t INVALID_HANDLE = UINT32_MAX;
+
+   //the same file reached with other separators or "./" segments gets the same key
+   static std::string normalizePath(const std::string& path);
+
+   //INVALID_HANDLE when nothing matches, the path must be normalized
+   uint32_t findByPath(const std::string& path) const;
+   uint32_t findByContent(uint64_t contentHash) const;
+
+   //a handle with one reference, the slots of released textures are reused
+   uint32_t add(const std::string& path, uint64_t contentHash);
+   //another path that leads to the same texture
+   void addAlias(uint32_t handle, const std::string& path);
+
+   void acquire(uint32_t handle);
+   //true when that was the last reference, the handle and its paths are free after that
+   bool release(uint32_t handle);
+
+   uint32_t getReferenceCount(uint32_t handle) const;
+   //one past the highest handle in use
+   uint32_t getSlotCount() const;
+
+   void clear();
+
+private:
+   struct Entry
+   {
+      uint32_t references = 0;
+      uint64_t contentHash = 0;
+      std::vector<std::string> paths;
+   };
+
+   std::vector<Entry> entries;
+   std::vector<uint32_t> freeHandles;
+   std::unordered_map<std::string, uint32_t> handlesByPath;
+   std::unordered_map<uint64_t, uint32_t> handlesByContent;
+};
@@ -0,0 +1,126 @@
+#include "threadpool.h"
+
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+void ThreadPool::init(uint32_t threadCount)
+{
+   cleanup();
+
+   if (threadCount == 0)
+      threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+   stopping = false;
+   for (uint32_t i = 0; i < threadCount; ++i)
+      workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+void ThreadPool::cleanup()
+{
+   {
+      std::lock_guard<std::mutex> lock(jobsMutex);
+      stopping = true;
+   }
+   jobsAvailable.notify_all();
+
+   for (auto& worker : workers)
+      worker.join();
+
+   workers.clear();
+   jobs.clear();
+}
+
+ThreadPool::~ThreadPool()
+{
+   cleanup();
+}
+
+uint32_t ThreadPool::getThreadCount() const
+{
+   return static_cast<uint32_t>(workers.size());
+}
+
+void ThreadPool::workerLoop()
+{
+   for (;;)
+   {
+      std::function<void()> job;
+      {
+         std::unique_lock<std::mutex> lock(jobsMutex);
+         jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+         if (stopping && jobs.empty())
+            return;
+
+         job = std::move(jobs.front());
+         jobs.pop_front();
+      }
+      job();
+   }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+   if (count == 0)
+      return;
+
+   //shared with the helper jobs, a helper that starts after all items are taken only touches this state
+   struct Range
+   {
+      std::atomic<size_t> next{ 0 };
+      std::atomic<size_t> finished{ 0 };
+      size_t count = 0;
+      const std::function<void(size_t)>* task = nullptr;
+      std::mutex mutex;
+      std::condition_variable done;
+      std::exception_ptr exception;
+   };
+
+   auto range = std::make_shared<Range>();
+   range->count = count;
+   range->task = &task;
+
+   auto work = [range]()
+   {
+      for (size_t i = range->next++; i < range->count; i = range->next++)
+      {
+         try
+         {
+            (*range->task)(i);
+         }
+         catch (...)
+         {
+            std::lock_guard<std::mutex> lock(range->mutex);
+            if (!range->exception)
+               range->exception = std::current_exception();
+         }
+
+         if (++range->finished == range->count)
+         {
+            std::lock_guard<std::mutex> lock(range->mutex);
+            range->done.notify_all();
+         }
+      }
+   };
+
+   size_t helpers = std::min<size_t>(workers.size(), count - 1);
+   {
+      std::lock_guard<std::mutex> lock(jobsMutex);
+      for (size_t i = 0; i < helpers; ++i)
+         jobs.emplace_back(work);
+   }
+   jobsAvailable.notify_all();
+
+   work();
+
+   std::exception_ptr exception;
+   {
+      std::unique_lock<std::mutex> lock(range->mutex);
+      range->done.wait(lock, [&range]() { return range->finished == range->count; });
+      exception = std::move(range->exception); //a late helper may release the range on its own thread
+   }
+
+   if (exception)
+      std::rethrow_exception(exception);
+}
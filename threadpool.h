@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//fixed set of worker threads, the thread that calls parallelFor works on the items too
+class ThreadPool
+{
+public:
+   ThreadPool() = default;
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+
+   //0 uses one worker less than the hardware threads, the caller is the last one
+   void init(uint32_t threadCount = 0);
+   void cleanup();
+
+   //calls task for every index in [0, count) and returns when all are done, the first exception thrown by a task is rethrown
+   void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+   uint32_t getThreadCount() const;
+
+   ~ThreadPool();
+
+private:
+   void workerLoop();
+
+   std::vector<std::thread> workers;
+   std::deque<std::function<void()>> jobs;
+   std::mutex jobsMutex;
+   std::condition_variable jobsAvailable;
+   bool stopping = false;
+};
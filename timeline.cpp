@@ -0,0 +1,119 @@
+#include "timeline.h"
+
+#include <stdexcept>
+
+void Timeline::init(VkDevice logicalDevice)
+{
+   this->logicalDevice = logicalDevice;
+
+   getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(logicalDevice, "vkGetSemaphoreCounterValueKHR");
+   waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(logicalDevice, "vkWaitSemaphoresKHR");
+   if (!getSemaphoreCounterValue || !waitSemaphores)
+      throw std::runtime_error("Timeline semaphores are not enabled on the device");
+
+   VkSemaphoreTypeCreateInfoKHR typeCreateInfo = {};
+   typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+   typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+   typeCreateInfo.initialValue = 0;
+
+   VkSemaphoreCreateInfo createInfo = {};
+   createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+   createInfo.pNext = &typeCreateInfo;
+
+   if (VK_SUCCESS != vkCreateSemaphore(logicalDevice, &createInfo, nullptr, &semaphore))
+      throw std::runtime_error("Unable to create timeline semaphore");
+
+   lastSubmitted = 0;
+   completed = 0;
+}
+
+void Timeline::cleanup()
+{
+   if (semaphore != VK_NULL_HANDLE)
+      vkDestroySemaphore(logicalDevice, semaphore, nullptr);
+   semaphore = VK_NULL_HANDLE;
+}
+
+Timeline::~Timeline()
+{
+   cleanup();
+}
+
+VkSemaphore Timeline::get() const
+{
+   return semaphore;
+}
+
+uint64_t Timeline::getNext() const
+{
+   return lastSubmitted + 1;
+}
+
+uint64_t Timeline::next()
+{
+   return ++lastSubmitted;
+}
+
+uint64_t Timeline::getLastSubmitted() const
+{
+   return lastSubmitted;
+}
+
+uint64_t Timeline::getCompleted()
+{
+   if (completed == lastSubmitted)
+      return completed;
+
+   uint64_t value = 0;
+   if (VK_SUCCESS != getSemaphoreCounterValue(logicalDevice, semaphore, &value))
+      throw std::runtime_error("Unable to read the timeline semaphore");
+
+   completed = value;
+   return completed;
+}
+
+bool Timeline::reached(uint64_t value)
+{
+   return value <= completed || value <= getCompleted();
+}
+
+void Timeline::wait(uint64_t value)
+{
+   if (reached(value))
+      return;
+
+   VkSemaphoreWaitInfoKHR waitInfo = {};
+   waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+   waitInfo.semaphoreCount = 1;
+   waitInfo.pSemaphores = &semaphore;
+   waitInfo.pValues = &value;
+
+   if (VK_SUCCESS != waitSemaphores(logicalDevice, &waitInfo, UINT64_MAX))
+      throw std::runtime_error("Error while waiting for the timeline semaphore");
+
+   completed = value;
+}
+
+void DeletionQueue::push(uint64_t value, std::function<void()>&& destroy)
+{
+   Entry entry;
+   entry.value = value;
+   entry.destroy = std::move(destroy);
+   entries.push_back(std::move(entry));
+}
+
+void DeletionQueue::collect(uint64_t completedValue)
+{
+   while (!entries.empty() && entries.front().value <= completedValue)
+   {
+      //popped first, so an entry that throws is not run again
+      Entry entry = std::move(entries.front());
+      entries.pop_front();
+      entry.destroy();
+   }
+}
+
+void DeletionQueue::flush()
+{
+   collect(UINT64_MAX);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+//a timeline semaphore, every submission signals a higher value and the cpu waits for or polls any of them
+//the device must have VK_KHR_timeline_semaphore enabled, the entry points are loaded from it
+class Timeline
+{
+public:
+   Timeline() = default;
+   Timeline(const Timeline&) = delete;
+   Timeline& operator=(const Timeline&) = delete;
+
+   void init(VkDevice logicalDevice);
+   void cleanup();
+
+   VkSemaphore get() const;
+   //the value for the next submission to signal, the values must reach the queue in this order
+   uint64_t getNext() const;
+   //called once the submission signaling getNext() was accepted by the queue, returns its value
+   uint64_t next();
+   //0 before the first submission
+   uint64_t getLastSubmitted() const;
+   //polls the counter, never blocks
+   uint64_t getCompleted();
+   bool reached(uint64_t value);
+   void wait(uint64_t value);
+
+   ~Timeline();
+
+private:
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   VkSemaphore semaphore = VK_NULL_HANDLE;
+   PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+   PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+   uint64_t lastSubmitted = 0;
+   uint64_t completed = 0; //the highest value seen so far, the older ones need no query
+};
+
+//destroys what the gpu may still be using once a timeline reaches the value it was pushed with
+class DeletionQueue
+{
+public:
+   //the values must not decrease from one push to the next
+   void push(uint64_t value, std::function<void()>&& destroy);
+   //runs the entries up to completedValue in the order they were pushed
+   void collect(uint64_t completedValue);
+   //runs all of them, the device must be idle
+   void flush();
+
+private:
+   struct Entry
+   {
+      uint64_t value = 0;
+      std::function<void()> destroy;
+   };
+
+   std::deque<Entry> entries;
+};
@@ -0,0 +1,584 @@
+#include "upload.h"
+#include "utils.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+bool UploadQueues::separateTransferFamily() const
+{
+   return transferFamily != graphicsFamily;
+}
+
+UploadTicket::UploadTicket(UploadTicket&& other) :
+   logicalDevice(other.logicalDevice),
+   allocator(other.allocator),
+   queues(other.queues),
+   transferCommandBuffer(other.transferCommandBuffer),
+   graphicsCommandBuffer(other.graphicsCommandBuffer),
+   uploadValue(other.uploadValue),
+   stagingBuffers(std::move(other.stagingBuffers))
+{
+   other.transferCommandBuffer = VK_NULL_HANDLE;
+   other.graphicsCommandBuffer = VK_NULL_HANDLE;
+   other.uploadValue = 0;
+   other.stagingBuffers.clear();
+}
+
+UploadTicket& UploadTicket::operator=(UploadTicket&& other)
+{
+   if (this == &other)
+      return *this;
+
+   wait();
+
+   logicalDevice = other.logicalDevice;
+   allocator = other.allocator;
+   queues = other.queues;
+   transferCommandBuffer = other.transferCommandBuffer;
+   graphicsCommandBuffer = other.graphicsCommandBuffer;
+   uploadValue = other.uploadValue;
+   stagingBuffers = std::move(other.stagingBuffers);
+
+   other.transferCommandBuffer = VK_NULL_HANDLE;
+   other.graphicsCommandBuffer = VK_NULL_HANDLE;
+   other.uploadValue = 0;
+   other.stagingBuffers.clear();
+
+   return *this;
+}
+
+bool UploadTicket::ready() const
+{
+   if (uploadValue == 0)
+      return true;
+
+   return queues.uploadTimeline->reached(uploadValue);
+}
+
+void UploadTicket::wait()
+{
+   if (uploadValue != 0)
+      queues.uploadTimeline->wait(uploadValue);
+
+   release();
+}
+
+void UploadTicket::release()
+{
+   for (auto& i : stagingBuffers)
+      destroyBuffer(*allocator, logicalDevice, &i.buffer, &i.memory);
+   stagingBuffers.clear();
+
+   if (transferCommandBuffer != VK_NULL_HANDLE)
+      vkFreeCommandBuffers(logicalDevice, queues.transferCommandPool, 1, &transferCommandBuffer);
+   transferCommandBuffer = VK_NULL_HANDLE;
+
+   if (graphicsCommandBuffer != VK_NULL_HANDLE)
+      vkFreeCommandBuffers(logicalDevice, queues.graphicsCommandPool, 1, &graphicsCommandBuffer);
+   graphicsCommandBuffer = VK_NULL_HANDLE;
+
+   uploadValue = 0;
+}
+
+UploadTicket::~UploadTicket()
+{
+   wait();
+}
+
+UploadBatch::UploadBatch(DeviceMemoryAllocator* allocator, VkDevice logicalDevice, const UploadQueues& queues) :
+   logicalDevice(logicalDevice),
+   allocator(allocator),
+   queues(queues)
+{
+   commandBuffer = beginCommandBuffer(queues.transferCommandPool);
+}
+
+VkCommandBuffer UploadBatch::beginCommandBuffer(VkCommandPool commandPool) const
+{
+   VkCommandBuffer out = VK_NULL_HANDLE;
+
+   VkCommandBufferAllocateInfo allocateInfo = {};
+   allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+   allocateInfo.commandBufferCount = 1;
+   allocateInfo.commandPool = commandPool;
+   allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+   if (VK_SUCCESS != vkAllocateCommandBuffers(logicalDevice, &allocateInfo, &out))
+      throw std::runtime_error("Unable to allocate the upload command buffer");
+
+   VkCommandBufferBeginInfo beginInfo = {};
+   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+   beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+   if (VK_SUCCESS != vkBeginCommandBuffer(out, &beginInfo))
+      throw std::runtime_error("Unable to begin the upload command buffer");
+
+   return out;
+}
+
+StagingBuffer& UploadBatch::createStagingBuffer(const void* data, VkDeviceSize size)
+{
+   StagingBuffer staging;
+   creteBuffer(*allocator, logicalDevice, size,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      &staging.buffer, &staging.memory);
+
+   memcpy(staging.memory.mappedData, data, size);
+
+   stagingBuffers.push_back(staging);
+   return stagingBuffers.back();
+}
+
+void UploadBatch::uploadBuffer(VkBuffer destination, VkDeviceSize destinationOffset, const void* data, VkDeviceSize size)
+{
+   if (size == 0)
+      return;
+
+   const StagingBuffer& staging = createStagingBuffer(data, size);
+
+   VkBufferCopy region = {};
+   region.dstOffset = destinationOffset;
+   region.size = size;
+   vkCmdCopyBuffer(commandBuffer, staging.buffer, destination, 1, &region);
+
+   if (queues.separateTransferFamily())
+   {
+      VkBufferMemoryBarrier ownershipBarrier = {};
+      ownershipBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      ownershipBarrier.srcQueueFamilyIndex = queues.transferFamily;
+      ownershipBarrier.dstQueueFamilyIndex = queues.graphicsFamily;
+      ownershipBarrier.buffer = destination;
+      ownershipBarrier.offset = destinationOffset;
+      ownershipBarrier.size = size;
+      bufferOwnershipBarriers.push_back(ownershipBarrier);
+   }
+
+   hasBufferUploads = true;
+   hasCommands = true;
+}
+
+void UploadBatch::uploadImage(VkImage destination, uint32_t width, uint32_t height, const void* data, VkDeviceSize size, const std::vector<VkDeviceSize>& levelOffsets)
+{
+   const StagingBuffer& staging = createStagingBuffer(data, size);
+
+   transitionImageLayout(destination, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+   uint32_t mipLevels = levelOffsets.empty() ? 1 : static_cast<uint32_t>(levelOffsets.size());
+   std::vector<VkBufferImageCopy> regions(mipLevels);
+   for (uint32_t i = 0; i < mipLevels; ++i)
+   {
+      VkBufferImageCopy& region = regions[i];
+      region.bufferOffset = levelOffsets.empty() ? 0 : levelOffsets[i];
+      region.bufferRowLength = 0;
+      region.bufferImageHeight = 0;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = i;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount = 1;
+      region.imageOffset = { 0, 0, 0 };
+      region.imageExtent = { std::max(width >> i, 1u), std::max(height >> i, 1u), 1 };
+   }
+
+   vkCmdCopyBufferToImage(commandBuffer, staging.buffer, destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions.data());
+
+   if (!queues.separateTransferFamily())
+   {
+      transitionImageLayout(destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      return;
+   }
+
+   //the layout change happens as part of the ownership transfer
+   VkImageMemoryBarrier ownershipBarrier = {};
+   ownershipBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+   ownershipBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   ownershipBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+   ownershipBarrier.srcQueueFamilyIndex = queues.transferFamily;
+   ownershipBarrier.dstQueueFamilyIndex = queues.graphicsFamily;
+   ownershipBarrier.image = destination;
+   ownershipBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+   ownershipBarrier.subresourceRange.baseArrayLayer = 0;
+   ownershipBarrier.subresourceRange.baseMipLevel = 0;
+   ownershipBarrier.subresourceRange.layerCount = 1;
+   ownershipBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+   imageOwnershipBarriers.push_back(ownershipBarrier);
+}
+
+void UploadBatch::uploadImageWithMipGeneration(VkImage destination, uint32_t width, uint32_t height, uint32_t mipLevels, const void* data, VkDeviceSize size)
+{
+   const StagingBuffer& staging = createStagingBuffer(data, size);
+
+   transitionImageLayout(destination, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+   VkBufferImageCopy region = {};
+   region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+   region.imageSubresource.mipLevel = 0;
+   region.imageSubresource.baseArrayLayer = 0;
+   region.imageSubresource.layerCount = 1;
+   region.imageExtent = { width, height, 1 };
+
+   vkCmdCopyBufferToImage(commandBuffer, staging.buffer, destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+   MipChain chain;
+   chain.image = destination;
+   chain.width = width;
+   chain.height = height;
+   chain.mipLevels = mipLevels;
+   mipChains.push_back(chain);
+
+   if (!queues.separateTransferFamily())
+      return;
+
+   //the image stays in transfer dst, recordMipGeneration moves it to shader read once the graphics queue owns it
+   VkImageMemoryBarrier ownershipBarrier = {};
+   ownershipBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+   ownershipBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   ownershipBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   ownershipBarrier.srcQueueFamilyIndex = queues.transferFamily;
+   ownershipBarrier.dstQueueFamilyIndex = queues.graphicsFamily;
+   ownershipBarrier.image = destination;
+   ownershipBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+   ownershipBarrier.subresourceRange.baseArrayLayer = 0;
+   ownershipBarrier.subresourceRange.baseMipLevel = 0;
+   ownershipBarrier.subresourceRange.layerCount = 1;
+   ownershipBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+   imageOwnershipBarriers.push_back(ownershipBarrier);
+}
+
+void UploadBatch::recordMipGeneration(VkCommandBuffer graphicsCommandBuffer)
+{
+   for (const auto& chain : mipChains)
+   {
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = chain.image;
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount = 1;
+      barrier.subresourceRange.levelCount = 1;
+
+      int32_t width = static_cast<int32_t>(chain.width);
+      int32_t height = static_cast<int32_t>(chain.height);
+
+      //every level is blitted from the previous one, which is then done and can go to shader read
+      for (uint32_t i = 1; i < chain.mipLevels; ++i)
+      {
+         barrier.subresourceRange.baseMipLevel = i - 1;
+         barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+         barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+         barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+         barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+         vkCmdPipelineBarrier(graphicsCommandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier);
+
+         VkImageBlit blit = {};
+         blit.srcOffsets[1] = { width, height, 1 };
+         blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+         blit.srcSubresource.mipLevel = i - 1;
+         blit.srcSubresource.baseArrayLayer = 0;
+         blit.srcSubresource.layerCount = 1;
+
+         width = std::max(width / 2, 1);
+         height = std::max(height / 2, 1);
+
+         blit.dstOffsets[1] = { width, height, 1 };
+         blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+         blit.dstSubresource.mipLevel = i;
+         blit.dstSubresource.baseArrayLayer = 0;
+         blit.dstSubresource.layerCount = 1;
+
+         vkCmdBlitImage(graphicsCommandBuffer,
+            chain.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            chain.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, VK_FILTER_LINEAR);
+
+         barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+         barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+         barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+         vkCmdPipelineBarrier(graphicsCommandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier);
+      }
+
+      //the last level was only written
+      barrier.subresourceRange.baseMipLevel = chain.mipLevels - 1;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      vkCmdPipelineBarrier(graphicsCommandBuffer,
+         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+         0,
+         0, nullptr,
+         0, nullptr,
+         1, &barrier);
+   }
+
+   if (!mipChains.empty())
+      hasCommands = true;
+
+   mipChains.clear();
+}
+
+void UploadBatch::transitionImageLayout(VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout)
+{
+   VkImageMemoryBarrier memoryBarier = {};
+   memoryBarier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+   memoryBarier.oldLayout = currentLayout;
+   memoryBarier.newLayout = newLayout;
+   memoryBarier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   memoryBarier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   memoryBarier.image = image;
+   memoryBarier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+   memoryBarier.subresourceRange.baseArrayLayer = 0;
+   memoryBarier.subresourceRange.baseMipLevel = 0;
+   memoryBarier.subresourceRange.layerCount = 1;
+   memoryBarier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+
+   VkPipelineStageFlags sourceStage = VK_PIPELINE_STAGE_NONE;
+   VkPipelineStageFlags destinationStage = VK_PIPELINE_STAGE_NONE;
+
+   if (currentLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+   {
+      memoryBarier.srcAccessMask = VK_ACCESS_NONE;
+      memoryBarier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+   }
+   else if (currentLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+   {
+      memoryBarier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      memoryBarier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+   }
+   else
+   {
+      throw std::runtime_error("Unknown transition");
+   }
+
+   vkCmdPipelineBarrier(commandBuffer,
+      sourceStage, destinationStage,
+      0,
+      0, nullptr,
+      0, nullptr,
+      1, &memoryBarier);
+
+   hasCommands = true;
+}
+
+bool UploadBatch::empty() const
+{
+   return !hasCommands;
+}
+
+void UploadBatch::recordOwnershipTransfer(VkCommandBuffer graphicsCommandBuffer)
+{
+   //release on the transfer queue
+   for (auto& i : bufferOwnershipBarriers)
+   {
+      i.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      i.dstAccessMask = VK_ACCESS_NONE;
+   }
+   for (auto& i : imageOwnershipBarriers)
+   {
+      i.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      i.dstAccessMask = VK_ACCESS_NONE;
+   }
+
+   vkCmdPipelineBarrier(commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0,
+      0, nullptr,
+      static_cast<uint32_t>(bufferOwnershipBarriers.size()), bufferOwnershipBarriers.data(),
+      static_cast<uint32_t>(imageOwnershipBarriers.size()), imageOwnershipBarriers.data());
+
+   //acquire on the graphics queue, after the semaphore wait
+   for (auto& i : bufferOwnershipBarriers)
+   {
+      i.srcAccessMask = VK_ACCESS_NONE;
+      i.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+   }
+   //the images that still get their mip levels blitted stay in transfer dst
+   for (auto& i : imageOwnershipBarriers)
+   {
+      i.srcAccessMask = VK_ACCESS_NONE;
+      i.dstAccessMask = i.newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+   }
+
+   vkCmdPipelineBarrier(graphicsCommandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      0,
+      0, nullptr,
+      static_cast<uint32_t>(bufferOwnershipBarriers.size()), bufferOwnershipBarriers.data(),
+      static_cast<uint32_t>(imageOwnershipBarriers.size()), imageOwnershipBarriers.data());
+
+   bufferOwnershipBarriers.clear();
+   imageOwnershipBarriers.clear();
+}
+
+UploadTicket UploadBatch::submit()
+{
+   UploadTicket ticket;
+   ticket.logicalDevice = logicalDevice;
+   ticket.allocator = allocator;
+   ticket.queues = queues;
+
+   if (!hasCommands)
+   {
+      release();
+      return ticket;
+   }
+
+   //nothing is created per batch, the ticket only keeps the value its last submission signals
+   //the values are only taken once submitted, a ticket of a failed submission must not wait for them
+   VkSemaphore uploadSemaphore = queues.uploadTimeline->get();
+   uint64_t uploadValue = queues.uploadTimeline->getNext();
+
+   ticket.transferCommandBuffer = commandBuffer;
+   ticket.stagingBuffers = std::move(stagingBuffers);
+   commandBuffer = VK_NULL_HANDLE;
+   stagingBuffers.clear();
+
+   if (queues.separateTransferFamily())
+   {
+      ticket.graphicsCommandBuffer = beginCommandBuffer(queues.graphicsCommandPool);
+      recordOwnershipTransfer(ticket.graphicsCommandBuffer);
+      recordMipGeneration(ticket.graphicsCommandBuffer);
+
+      if (VK_SUCCESS != vkEndCommandBuffer(ticket.transferCommandBuffer) || VK_SUCCESS != vkEndCommandBuffer(ticket.graphicsCommandBuffer))
+         throw std::runtime_error("Unable to end the upload command buffers");
+
+      //the copy timeline is only signaled by the transfer queue and the upload one only by the graphics queue, so each of them grows in submission order
+      VkSemaphore copySemaphore = queues.copyTimeline->get();
+      uint64_t copyValue = queues.copyTimeline->getNext();
+
+      VkTimelineSemaphoreSubmitInfoKHR transferTimelineInfo = {};
+      transferTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+      transferTimelineInfo.signalSemaphoreValueCount = 1;
+      transferTimelineInfo.pSignalSemaphoreValues = &copyValue;
+
+      VkSubmitInfo transferSubmitInfo = {};
+      transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      transferSubmitInfo.pNext = &transferTimelineInfo;
+      transferSubmitInfo.pCommandBuffers = &ticket.transferCommandBuffer;
+      transferSubmitInfo.commandBufferCount = 1;
+      transferSubmitInfo.pSignalSemaphores = &copySemaphore;
+      transferSubmitInfo.signalSemaphoreCount = 1;
+
+      if (VK_SUCCESS != vkQueueSubmit(queues.transferQueue, 1, &transferSubmitInfo, VK_NULL_HANDLE))
+         throw std::runtime_error("Unable to submit upload batch");
+      queues.copyTimeline->next();
+
+      //the value of the acquire submission also covers the transfer one, it can't start before the copies are done
+      VkTimelineSemaphoreSubmitInfoKHR graphicsTimelineInfo = {};
+      graphicsTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+      graphicsTimelineInfo.waitSemaphoreValueCount = 1;
+      graphicsTimelineInfo.pWaitSemaphoreValues = &copyValue;
+      graphicsTimelineInfo.signalSemaphoreValueCount = 1;
+      graphicsTimelineInfo.pSignalSemaphoreValues = &uploadValue;
+
+      VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      VkSubmitInfo graphicsSubmitInfo = {};
+      graphicsSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      graphicsSubmitInfo.pNext = &graphicsTimelineInfo;
+      graphicsSubmitInfo.pWaitSemaphores = &copySemaphore;
+      graphicsSubmitInfo.pWaitDstStageMask = &waitStage;
+      graphicsSubmitInfo.waitSemaphoreCount = 1;
+      graphicsSubmitInfo.pCommandBuffers = &ticket.graphicsCommandBuffer;
+      graphicsSubmitInfo.commandBufferCount = 1;
+      graphicsSubmitInfo.pSignalSemaphores = &uploadSemaphore;
+      graphicsSubmitInfo.signalSemaphoreCount = 1;
+
+      if (VK_SUCCESS != vkQueueSubmit(queues.graphicsQueue, 1, &graphicsSubmitInfo, VK_NULL_HANDLE))
+      {
+         //the ticket frees the staging buffers and the command buffers on the way out, the copies must be done with them first
+         queues.copyTimeline->wait(copyValue);
+         throw std::runtime_error("Unable to submit upload ownership transfer");
+      }
+      ticket.uploadValue = queues.uploadTimeline->next();
+   }
+   else
+   {
+      //the transfer family is the graphics one here, so the blits can go in the same command buffer
+      recordMipGeneration(ticket.transferCommandBuffer);
+
+      //one barrier for all the buffer copies, later submissions on the queue can read them as vertices, indices or uniforms
+      if (hasBufferUploads)
+      {
+         VkMemoryBarrier memoryBarrier = {};
+         memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+         memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+         memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+         vkCmdPipelineBarrier(ticket.transferCommandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+      }
+
+      if (VK_SUCCESS != vkEndCommandBuffer(ticket.transferCommandBuffer))
+         throw std::runtime_error("Unable to end the upload command buffer");
+
+      VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+      timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+      timelineInfo.signalSemaphoreValueCount = 1;
+      timelineInfo.pSignalSemaphoreValues = &uploadValue;
+
+      VkSubmitInfo submitInfo = {};
+      submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submitInfo.pNext = &timelineInfo;
+      submitInfo.pCommandBuffers = &ticket.transferCommandBuffer;
+      submitInfo.commandBufferCount = 1;
+      submitInfo.pSignalSemaphores = &uploadSemaphore;
+      submitInfo.signalSemaphoreCount = 1;
+
+      if (VK_SUCCESS != vkQueueSubmit(queues.transferQueue, 1, &submitInfo, VK_NULL_HANDLE))
+         throw std::runtime_error("Unable to submit upload batch");
+      ticket.uploadValue = queues.uploadTimeline->next();
+   }
+
+   hasBufferUploads = false;
+   hasCommands = false;
+
+   return ticket;
+}
+
+void UploadBatch::release()
+{
+   for (auto& i : stagingBuffers)
+      destroyBuffer(*allocator, logicalDevice, &i.buffer, &i.memory);
+   stagingBuffers.clear();
+
+   if (commandBuffer != VK_NULL_HANDLE)
+      vkFreeCommandBuffers(logicalDevice, queues.transferCommandPool, 1, &commandBuffer);
+   commandBuffer = VK_NULL_HANDLE;
+
+   bufferOwnershipBarriers.clear();
+   imageOwnershipBarriers.clear();
+   mipChains.clear();
+}
+
+UploadBatch::~UploadBatch()
+{
+   //a batch that was never submitted just drops what it recorded
+   release();
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+
+#include "allocator.h"
+#include "timeline.h"
+
+struct StagingBuffer
+{
+   VkBuffer buffer = VK_NULL_HANDLE;
+   MemoryAllocation memory;
+};
+
+//the copies run on the transfer queue, when its family differs from the graphics one the ownership is moved to graphics at the end
+struct UploadQueues
+{
+   VkQueue transferQueue = VK_NULL_HANDLE;
+   VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+   uint32_t transferFamily = 0;
+
+   VkQueue graphicsQueue = VK_NULL_HANDLE;
+   VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+   uint32_t graphicsFamily = 0;
+
+   Timeline* copyTimeline = nullptr; //signaled by the copies on the transfer queue, only with a separate transfer family
+   Timeline* uploadTimeline = nullptr; //signaled by the last submission of each batch, always on the same queue
+
+   bool separateTransferFamily() const;
+};
+
+//owns the command buffers and the staging memory of a submitted batch until the gpu is done with them
+class UploadTicket
+{
+public:
+   UploadTicket() {};
+   UploadTicket(UploadTicket&& other);
+   UploadTicket& operator=(UploadTicket&& other);
+   UploadTicket(const UploadTicket&) = delete;
+   UploadTicket& operator=(const UploadTicket&) = delete;
+
+   bool ready() const;
+   void wait();
+
+   ~UploadTicket();
+
+private:
+   friend class UploadBatch;
+
+   void release();
+
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   DeviceMemoryAllocator* allocator = nullptr;
+   UploadQueues queues;
+   VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+   VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+   uint64_t uploadValue = 0; //of the upload timeline, 0 when nothing was submitted
+   std::vector<StagingBuffer> stagingBuffers;
+};
+
+//records many buffer and image uploads into one command buffer that is submitted once
+class UploadBatch
+{
+public:
+   UploadBatch(DeviceMemoryAllocator* allocator, VkDevice logicalDevice, const UploadQueues& queues);
+   UploadBatch(const UploadBatch&) = delete;
+   UploadBatch& operator=(const UploadBatch&) = delete;
+
+   void uploadBuffer(VkBuffer destination, VkDeviceSize destinationOffset, const void* data, VkDeviceSize size);
+   //leaves the image in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, owned by the graphics family
+   //data holds every mip level one after the other, levelOffsets has the start of each one, a single level when empty
+   void uploadImage(VkImage destination, uint32_t width, uint32_t height, const void* data, VkDeviceSize size, const std::vector<VkDeviceSize>& levelOffsets = {});
+   //uploads level 0 and fills the other levels with linear blits, the format must support them
+   //blits need a graphics queue, with a separate transfer family they run after the ownership transfer
+   void uploadImageWithMipGeneration(VkImage destination, uint32_t width, uint32_t height, uint32_t mipLevels, const void* data, VkDeviceSize size);
+   void transitionImageLayout(VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
+
+   bool empty() const;
+   UploadTicket submit();
+
+   ~UploadBatch();
+
+private:
+   StagingBuffer& createStagingBuffer(const void* data, VkDeviceSize size);
+   VkCommandBuffer beginCommandBuffer(VkCommandPool commandPool) const;
+   void recordOwnershipTransfer(VkCommandBuffer graphicsCommandBuffer);
+   void recordMipGeneration(VkCommandBuffer graphicsCommandBuffer);
+   void release();
+
+   VkDevice logicalDevice = VK_NULL_HANDLE;
+   DeviceMemoryAllocator* allocator = nullptr;
+   UploadQueues queues;
+   VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+   std::vector<StagingBuffer> stagingBuffers;
+   std::vector<VkBufferMemoryBarrier> bufferOwnershipBarriers;
+   std::vector<VkImageMemoryBarrier> imageOwnershipBarriers;
+
+   struct MipChain
+   {
+      VkImage image = VK_NULL_HANDLE;
+      uint32_t width = 0;
+      uint32_t height = 0;
+      uint32_t mipLevels = 0;
+   };
+   std::vector<MipChain> mipChains;
+   bool hasBufferUploads = false;
+   bool hasCommands = false;
+};
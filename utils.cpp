@@ -1,9 +1,23 @@
 #include "utils.h"
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 std::vector<char> readFile(const char* filePath)
 {
    std::vector<char> out;
@@ -40,6 +54,158 @@ std::vector<char> readFile(const char* filePath)
    return out;
 }
 
+bool MappedFile::open(const std::string& filePath)
+{
+   close();
+
+#ifdef _WIN32
+   HANDLE handle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (handle == INVALID_HANDLE_VALUE)
+      return false;
+   fileHandle = handle;
+
+   LARGE_INTEGER fileSize = {};
+   if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0)
+   {
+      close();
+      return false;
+   }
+
+   mappingHandle = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+   if (!mappingHandle)
+   {
+      close();
+      return false;
+   }
+
+   data = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+   size = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+   fileDescriptor = ::open(filePath.c_str(), O_RDONLY);
+   if (fileDescriptor < 0)
+      return false;
+
+   struct stat status = {};
+   if (fstat(fileDescriptor, &status) != 0 || status.st_size == 0)
+   {
+      close();
+      return false;
+   }
+
+   void* mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+   data = mapping == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(mapping);
+   size = static_cast<uint64_t>(status.st_size);
+#endif
+
+   if (!data)
+   {
+      close();
+      return false;
+   }
+
+   return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+   if (data)
+      UnmapViewOfFile(data);
+   if (mappingHandle)
+      CloseHandle(mappingHandle);
+   if (fileHandle)
+      CloseHandle(fileHandle);
+
+   mappingHandle = nullptr;
+   fileHandle = nullptr;
+#else
+   if (data)
+      munmap(const_cast<uint8_t*>(data), static_cast<size_t>(size));
+   if (fileDescriptor >= 0)
+      ::close(fileDescriptor);
+
+   fileDescriptor = -1;
+#endif
+
+   data = nullptr;
+   size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+   close();
+}
+
+const uint8_t* MappedFile::getData() const
+{
+   return data;
+}
+
+uint64_t MappedFile::getSize() const
+{
+   return size;
+}
+
+static bool getSourceStatus(const std::string& sourcePath, uint64_t* size, int64_t* timestamp)
+{
+#ifdef _WIN32
+   struct _stat64 status = {};
+   if (_stat64(sourcePath.c_str(), &status) != 0)
+      return false;
+#else
+   struct stat status = {};
+   if (stat(sourcePath.c_str(), &status) != 0)
+      return false;
+#endif
+
+   *size = static_cast<uint64_t>(status.st_size);
+   *timestamp = static_cast<int64_t>(status.st_mtime);
+   return true;
+}
+
+uint64_t hashData(const void* data, uint64_t size, uint64_t hash)
+{
+   const uint8_t* bytes = static_cast<const uint8_t*>(data);
+   for (uint64_t i = 0; i < size; ++i)
+   {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
+
+static uint64_t hashSource(const std::string& sourcePath)
+{
+   MappedFile source;
+   if (!source.open(sourcePath))
+      return 0;
+
+   return hashData(source.getData(), source.getSize());
+}
+
+bool readSourceStamp(const std::string& sourcePath, SourceStamp* stamp)
+{
+   if (!getSourceStatus(sourcePath, &stamp->size, &stamp->timestamp))
+      return false;
+
+   stamp->hash = hashSource(sourcePath);
+   return true;
+}
+
+bool matchesSourceStamp(const std::string& sourcePath, const SourceStamp& stamp)
+{
+   uint64_t size = 0;
+   int64_t timestamp = 0;
+   if (!getSourceStatus(sourcePath, &size, &timestamp))
+      return true;
+
+   if (size == stamp.size && timestamp == stamp.timestamp)
+      return true;
+
+   //touched or copied sources keep their cache as long as the bytes did not change
+   return size == stamp.size && hashSource(sourcePath) == stamp.hash;
+}
+
 Image readImage(const char* filePath, ReadImageChannels channels)
 {
    Image out;
@@ -70,10 +236,64 @@ Image readImage(const char* filePath, ReadImageChannels channels)
    return out;
 }
 
-uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
+uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+{
+   uint32_t out = 1;
+   for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+      ++out;
+   return out;
+}
+
+std::vector<char> buildMipChain(const Image& image, uint32_t components, uint32_t mipLevels, std::vector<VkDeviceSize>* levelOffsets)
 {
-   //TODO: Check available size of heap ? Maybe a manager ?
+   levelOffsets->clear();
 
+   VkDeviceSize totalSize = 0;
+   for (uint32_t level = 0; level < mipLevels; ++level)
+   {
+      levelOffsets->push_back(totalSize);
+      totalSize += static_cast<VkDeviceSize>(std::max(image.width >> level, 1u)) * std::max(image.height >> level, 1u) * components;
+   }
+
+   std::vector<char> out(static_cast<size_t>(totalSize));
+   memcpy(out.data(), image.data.data(), image.data.size());
+
+   uint32_t sourceWidth = image.width;
+   uint32_t sourceHeight = image.height;
+   for (uint32_t level = 1; level < mipLevels; ++level)
+   {
+      const unsigned char* source = reinterpret_cast<const unsigned char*>(out.data() + (*levelOffsets)[level - 1]);
+      unsigned char* destination = reinterpret_cast<unsigned char*>(out.data() + (*levelOffsets)[level]);
+      uint32_t width = std::max(sourceWidth / 2, 1u);
+      uint32_t height = std::max(sourceHeight / 2, 1u);
+
+      //the last row or column of an odd sized level is reused instead of read past the edge
+      for (uint32_t y = 0; y < height; ++y)
+      {
+         uint32_t y0 = std::min(y * 2, sourceHeight - 1);
+         uint32_t y1 = std::min(y * 2 + 1, sourceHeight - 1);
+         for (uint32_t x = 0; x < width; ++x)
+         {
+            uint32_t x0 = std::min(x * 2, sourceWidth - 1);
+            uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1);
+            for (uint32_t c = 0; c < components; ++c)
+            {
+               uint32_t sum = source[(y0 * sourceWidth + x0) * components + c] + source[(y0 * sourceWidth + x1) * components + c] +
+                  source[(y1 * sourceWidth + x0) * components + c] + source[(y1 * sourceWidth + x1) * components + c];
+               destination[(y * width + x) * components + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+         }
+      }
+
+      sourceWidth = width;
+      sourceHeight = height;
+   }
+
+   return out;
+}
+
+uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
+{
    VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties = {};
    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &physicalDeviceMemoryProperties);
    for (uint32_t i = 0; i < physicalDeviceMemoryProperties.memoryTypeCount; ++i)
@@ -88,8 +308,8 @@ uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTy
    return UINT32_MAX;
 }
 
-void creteBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
-   VkMemoryPropertyFlags bufferProperties, VkBuffer* buffer, VkDeviceMemory* bufferMemory)
+void creteBuffer(DeviceMemoryAllocator& allocator, VkDevice logicalDevice, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
+   VkMemoryPropertyFlags bufferProperties, VkBuffer* buffer, MemoryAllocation* bufferMemory)
 {
    VkBufferCreateInfo bufferCreateInfo = {};
    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -103,145 +323,17 @@ void creteBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDevi
    VkMemoryRequirements memoryRequierments = {};
    vkGetBufferMemoryRequirements(logicalDevice, *buffer, &memoryRequierments);
 
-   VkMemoryAllocateInfo allocInfo = {};
-   allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-   allocInfo.allocationSize = memoryRequierments.size;
-   allocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memoryRequierments.memoryTypeBits, bufferProperties);
-
-   if (VK_SUCCESS != vkAllocateMemory(logicalDevice, &allocInfo, nullptr, bufferMemory))
-      throw std::runtime_error("Unable to allocate buffer memory");
+   *bufferMemory = allocator.allocate(memoryRequierments, bufferProperties, AllocationKind::linear);
 
-   if (VK_SUCCESS != vkBindBufferMemory(logicalDevice, *buffer, *bufferMemory, 0))
+   if (VK_SUCCESS != vkBindBufferMemory(logicalDevice, *buffer, bufferMemory->memory, bufferMemory->offset))
       throw std::runtime_error("Unable to allocate buffer memory");
 }
 
-static VkCommandBuffer beginCopyCommandBuffer(VkDevice logicalDevice, VkCommandPool commandPool)
-{
-   VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
-
-   VkCommandBufferAllocateInfo transferBufferAllocationInfo = {};
-   transferBufferAllocationInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-   transferBufferAllocationInfo.commandBufferCount = 1;
-   transferBufferAllocationInfo.commandPool = commandPool;
-   transferBufferAllocationInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-
-   if (VK_SUCCESS != vkAllocateCommandBuffers(logicalDevice, &transferBufferAllocationInfo, &transferCommandBuffer))
-      throw std::runtime_error("Unable to allocate the transfer command buffer");
-
-   VkCommandBufferBeginInfo transferBeginInfo = {};
-   transferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-   transferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-   if (VK_SUCCESS != vkBeginCommandBuffer(transferCommandBuffer, &transferBeginInfo))
-      throw std::runtime_error("Unable to begin the transfer command buffer");
-
-   return transferCommandBuffer;
-}
-
-static void endCopyCommandBuffer(VkDevice logicalDevice, VkQueue queue, VkCommandPool commandPool, VkCommandBuffer commandBuffer)
+void destroyBuffer(DeviceMemoryAllocator& allocator, VkDevice logicalDevice, VkBuffer* buffer, MemoryAllocation* bufferMemory)
 {
-   VkFence transferFence = VK_NULL_HANDLE;
-   VkFenceCreateInfo fenceCreateInfo = {};
-   fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-
-   if (VK_SUCCESS != vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &transferFence))
-      throw std::runtime_error("Unable to create transfer fence");
-
-   vkEndCommandBuffer(commandBuffer);
-
-   VkSubmitInfo submitInfo = {};
-   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-   submitInfo.pCommandBuffers = &commandBuffer;
-   submitInfo.commandBufferCount = 1;
-
-   if (VK_SUCCESS != vkQueueSubmit(queue, 1, &submitInfo, transferFence))
-      throw std::runtime_error("Unable to submit transfer buffer");
-
-   if (VK_SUCCESS != vkWaitForFences(logicalDevice, 1, &transferFence, VK_FALSE, UINT64_MAX))
-      throw std::runtime_error("Error while waiting for transfer to complete");
-
-   vkDestroyFence(logicalDevice, transferFence, nullptr);
-   vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
-}
-
-void copyBuffer(VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, VkBuffer destinationBuffer, VkBuffer sourceBuffer, VkDeviceSize size)
-{
-   VkCommandBuffer transferCommandBuffer = beginCopyCommandBuffer(logicalDevice, transferCommandPool);
-
-   VkBufferCopy region = {};
-   region.size = size;
-   vkCmdCopyBuffer(transferCommandBuffer, sourceBuffer, destinationBuffer, 1, &region);
-
-   endCopyCommandBuffer(logicalDevice, transferQueue, transferCommandPool, transferCommandBuffer);
-}
-
-void transitionImageLayout(VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout)
-{
-   VkCommandBuffer commandBuffer = beginCopyCommandBuffer(logicalDevice, transferCommandPool);
-
-   VkImageMemoryBarrier memoryBarier = {};
-   memoryBarier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-   memoryBarier.oldLayout = currentLayout;
-   memoryBarier.newLayout = newLayout;
-   memoryBarier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-   memoryBarier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-   memoryBarier.image = image;
-   memoryBarier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-   memoryBarier.subresourceRange.baseArrayLayer = 0;
-   memoryBarier.subresourceRange.baseMipLevel = 0;
-   memoryBarier.subresourceRange.layerCount = 1;
-   memoryBarier.subresourceRange.levelCount = 1;
-
-   VkPipelineStageFlags sourceStage = VK_PIPELINE_STAGE_NONE;
-   VkPipelineStageFlags destinationStage = VK_PIPELINE_STAGE_NONE;
-
-   if (currentLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-   {
-      memoryBarier.srcAccessMask = VK_ACCESS_NONE;
-      memoryBarier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-      destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-   } 
-   else if (currentLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-   {
-      memoryBarier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      memoryBarier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-      sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-      destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-   }
-   else
-   {
-      throw std::runtime_error("Unknown transition");
-   }
-
-   vkCmdPipelineBarrier(commandBuffer,
-      sourceStage, destinationStage,
-      0,
-      0, nullptr,
-      0, nullptr,
-      1, &memoryBarier);
-
-   endCopyCommandBuffer(logicalDevice, transferQueue, transferCommandPool, commandBuffer);
-}
-
-void copyImage(VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, VkImage destinationImage, VkBuffer sourceBuffer, uint32_t width, uint32_t height)
-{
-   VkCommandBuffer transferCommandBuffer = beginCopyCommandBuffer(logicalDevice, transferCommandPool);
-
-   VkBufferImageCopy region = {};
-   region.bufferOffset = 0;
-   region.bufferRowLength = 0;
-   region.bufferImageHeight = 0;
-   region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-   region.imageSubresource.mipLevel = 0;
-   region.imageSubresource.baseArrayLayer = 0;
-   region.imageSubresource.layerCount = 1;
-   region.imageOffset = { 0, 0, 0 };
-   region.imageExtent = { width, height, 1 };
-
-   vkCmdCopyBufferToImage(transferCommandBuffer, sourceBuffer, destinationImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+   if (*buffer != VK_NULL_HANDLE)
+      vkDestroyBuffer(logicalDevice, *buffer, nullptr);
+   *buffer = VK_NULL_HANDLE;
 
-   endCopyCommandBuffer(logicalDevice, transferQueue, transferCommandPool, transferCommandBuffer);
+   allocator.free(*bufferMemory);
 }
\ No newline at end of file
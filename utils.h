@@ -1,10 +1,55 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
 #include <vulkan/vulkan.h>
 
+#include "allocator.h"
+
 std::vector<char> readFile(const char* filePath);
 
+//read only view of a whole file, the pages are loaded by the os on first access
+class MappedFile
+{
+public:
+   MappedFile() = default;
+   MappedFile(const MappedFile&) = delete;
+   MappedFile& operator=(const MappedFile&) = delete;
+
+   bool open(const std::string& filePath);
+   void close();
+
+   const uint8_t* getData() const;
+   uint64_t getSize() const;
+
+   ~MappedFile();
+
+private:
+   const uint8_t* data = nullptr;
+   uint64_t size = 0;
+#ifdef _WIN32
+   void* fileHandle = nullptr;
+   void* mappingHandle = nullptr;
+#else
+   int fileDescriptor = -1;
+#endif
+};
+
+//FNV-1a, a hash from an earlier call continues it over more data
+uint64_t hashData(const void* data, uint64_t size, uint64_t hash = 14695981039346656037ull);
+
+//identifies the version of a source file that cooked data was made from
+struct SourceStamp
+{
+   uint64_t size = 0;
+   int64_t timestamp = 0;
+   uint64_t hash = 0;
+};
+
+bool readSourceStamp(const std::string& sourcePath, SourceStamp* stamp);
+//true when the source matches the stamp or is missing, so cooked data can be shipped alone
+bool matchesSourceStamp(const std::string& sourcePath, const SourceStamp& stamp);
+
 struct Image
 {
    uint32_t width;
@@ -23,14 +68,15 @@ enum class ReadImageChannels{
 
 Image readImage(const char* filePath, ReadImageChannels channels);
 
+//levels down to 1x1
+uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+//all the levels of an 8 bit per channel image one after the other, made with a 2x2 box filter
+std::vector<char> buildMipChain(const Image& image, uint32_t components, uint32_t mipLevels, std::vector<VkDeviceSize>* levelOffsets);
 
-uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties);
-
-void creteBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
-   VkMemoryPropertyFlags bufferProperties, VkBuffer* buffer, VkDeviceMemory* bufferMemory);
 
-void copyBuffer(VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, VkBuffer destinationBuffer, VkBuffer sourceBuffer, VkDeviceSize size);
+uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties);
 
-void copyImage(VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, VkImage destinationImage, VkBuffer sourceBuffer, uint32_t width, uint32_t height);
+void creteBuffer(DeviceMemoryAllocator& allocator, VkDevice logicalDevice, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
+   VkMemoryPropertyFlags bufferProperties, VkBuffer* buffer, MemoryAllocation* bufferMemory);
 
-void transitionImageLayout(VkDevice logicalDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
\ No newline at end of file
+void destroyBuffer(DeviceMemoryAllocator& allocator, VkDevice logicalDevice, VkBuffer* buffer, MemoryAllocation* bufferMemory);
\ No newline at end of file